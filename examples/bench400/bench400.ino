@@ -0,0 +1,150 @@
+/*
+ Pulse400 benchmark
+
+ Sweeps the channel count, the frequency and the pulse width distribution and prints a CSV table over Serial
+ so runs can be compared (diff the output of two builds to catch performance regressions):
+
+   build: ISR backend (uno, teensy, shift = 74HC595 chain or std = digitalWrite), queue layout and the assembly ISR option
+   channels, frequency: generator setup
+   dist: pulse widths, equal (one falling edge group), spread (evenly spaced) or random (fixed seed)
+   duty: percentage of the CPU taken by the generator interrupts (busy loop throughput against an idle run)
+   pulse_us: average cost of a pulse() call that changes the queue
+   set_us: average cost of a Multi400::set() call that changes every channel
+
+ A second table gives the queue RAM of the build: the double buffered queue plus the shared pin table of the
+ compact layout, taken from sizeof() on the target.
+
+ The option sets (PULSE400_OPTIMIZE_ARDUINO_UNO on or off, PULSE400_QUEUE_FAST/COMPACT, PULSE400_AVR_NAKED) are
+ compile time settings in Pulse400.h: build and run the sketch once per set. It only needs Serial, so it also runs
+ unchanged in a simulator (see the README).
+
+ With a wire from the first pin to LOOPBACK_PIN the falling edge latency per group size is measured with
+ calibrate() and printed as a second table.
+*/
+
+#include <Pulse400.h>
+
+#define WINDOW 500000UL // Microseconds per throughput measurement
+#define CALLS 200 // Calls per cost measurement
+#define LOOPBACK_PIN -1 // Rc400 input wired to pin[0], -1: skip the latency table
+
+Pulse400 pulse400;
+Multi400 motors( pulse400 );
+
+int8_t pin[8] = { 2, 3, 4, 5, 6, 7, 8, 9 };
+uint8_t channels[] = { 1, 2, 4, 8 };
+uint16_t frequency[] = { 50, 200, 400 };
+const char * dist[] = { "equal", "spread", "random" };
+
+int16_t speed[8]; // Multi400 values: 0..1000 = 1000..2000 us
+uint32_t idle;
+
+uint32_t throughput( void ) {
+  uint32_t cnt = 0;
+  uint32_t start = micros();
+  while ( micros() - start < WINDOW ) cnt++;
+  return cnt;
+}
+
+void distribute( uint8_t d, uint8_t n ) {
+  randomSeed( 400 );
+  for ( uint8_t i = 0; i < 8; i++ ) {
+    if ( i >= n ) {
+      speed[i] = -1; // Not attached: ignored by Multi400::set()
+    } else if ( d == 0 ) {
+      speed[i] = 500;
+    } else if ( d == 1 ) {
+      speed[i] = (uint32_t) i * 1000 / n;
+    } else {
+      speed[i] = random( 0, 1001 );
+    }
+  }
+}
+
+uint16_t queue_bytes( void ) {
+  uint16_t bytes = 2 * sizeof( queue_t );
+#if defined( PULSE400_QUEUE_COMPACT ) && !defined( PULSE400_OPTIMIZE_STANDARD )
+  bytes += PULSE400_MAX_CHANNELS * sizeof( pulse400_map_t );
+#endif
+  return bytes;
+}
+
+void run( uint8_t n, uint16_t f, uint8_t d ) {
+  motors.begin( pin[0], n > 1 ? pin[1] : -1, n > 2 ? pin[2] : -1, n > 3 ? pin[3] : -1,
+    n > 4 ? pin[4] : -1, n > 5 ? pin[5] : -1, n > 6 ? pin[6] : -1, n > 7 ? pin[7] : -1 );
+  motors.frequency( f );
+  distribute( d, n );
+  motors.set( speed[0], speed[1], speed[2], speed[3], speed[4], speed[5], speed[6], speed[7] );
+  delay( 50 );
+  uint32_t duty = 1000 - throughput() * 1000 / idle; // Permille
+
+  uint32_t start = micros();
+  for ( uint16_t i = 0; i < CALLS; i++ ) { // Toggle the lowest bit so every call moves an entry
+    pulse400.pulse( i % n, 1000 + speed[i % n] + ( ( i / n ) & 1 ) );
+  }
+  uint32_t pulse_cost = ( micros() - start ) * 10 / CALLS; // Tenths of a microsecond
+
+  start = micros();
+  for ( uint16_t i = 0; i < CALLS; i++ ) {
+    int16_t v[8];
+    for ( uint8_t ch = 0; ch < 8; ch++ ) v[ch] = speed[ch] < 0 ? -1 : speed[ch] + ( i & 1 );
+    motors.set( v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7] );
+  }
+  uint32_t set_cost = ( micros() - start ) * 10 / CALLS;
+  motors.end();
+
+#if defined( PULSE400_SHIFT_595 )
+  Serial.print( "shift" );
+#elif defined( PULSE400_OPTIMIZE_STANDARD )
+  Serial.print( "std" );
+#elif defined( __TEENSY_3X__ )
+  Serial.print( "teensy" );
+#else
+  Serial.print( "uno" );
+#endif
+#if defined( PULSE400_QUEUE_FAST )
+  Serial.print( "/fast" );
+#elif defined( PULSE400_QUEUE_COMPACT )
+  Serial.print( "/compact" );
+#endif
+#if defined( PULSE400_AVR_NAKED )
+  Serial.print( "/naked" );
+#endif
+  Serial.print( ',' ); Serial.print( n );
+  Serial.print( ',' ); Serial.print( f );
+  Serial.print( ',' ); Serial.print( dist[d] );
+  Serial.print( ',' ); Serial.print( duty / 10 ); Serial.print( '.' ); Serial.print( duty % 10 );
+  Serial.print( ',' ); Serial.print( pulse_cost / 10 ); Serial.print( '.' ); Serial.print( pulse_cost % 10 );
+  Serial.print( ',' ); Serial.print( set_cost / 10 ); Serial.print( '.' ); Serial.println( set_cost % 10 );
+}
+
+void setup() {
+  Serial.begin( 115200 );
+  while ( !Serial );
+  idle = throughput();
+  Serial.println( "build,channels,frequency,dist,duty,pulse_us,set_us" );
+  for ( uint8_t c = 0; c < sizeof( channels ); c++ ) {
+    for ( uint8_t f = 0; f < sizeof( frequency ) / sizeof( frequency[0] ); f++ ) {
+      for ( uint8_t d = 0; d < 3; d++ ) {
+        run( channels[c], frequency[f], d );
+      }
+    }
+  }
+  Serial.println( "entry_bytes,queue_bytes" );
+  Serial.print( sizeof( queue_struct_t ) ); Serial.print( ',' ); Serial.println( queue_bytes() );
+#if LOOPBACK_PIN > -1
+  Rc400 rc;
+  motors.begin( pin[0], pin[1], pin[2], pin[3], pin[4], pin[5], pin[6], pin[7] );
+  rc.pwm( LOOPBACK_PIN );
+  bool ok = pulse400.calibrate( rc, 0 );
+  rc.end();
+  motors.end();
+  Serial.println( "group,latency_us" );
+  for ( uint8_t n = 1; ok && n <= 8; n++ ) {
+    Serial.print( n ); Serial.print( ',' ); Serial.println( pulse400.latency( n ) );
+  }
+#endif
+}
+
+void loop() {
+}
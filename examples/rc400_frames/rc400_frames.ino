@@ -0,0 +1,148 @@
+/*
+ Rc400 frame decoder check
+
+ Feeds known good and corrupted SBUS and IBUS byte streams to Rc400::parse() and prints one line per check:
+
+   sbus_frame: a frame decodes all 16 channels, 172/992/1811 map to 988/1500/2012 us, SBUS2 end bytes pass
+   sbus_resync: junk, a truncated frame and a frame with a bad end byte are dropped, the next frames decode
+   sbus_failsafe: a frame with the failsafe flag is valid but keeps the old values and connected() goes false
+   ibus_frame: a frame decodes all 14 channels
+   ibus_checksum: a frame with a flipped bit or a bad command byte is rejected and changes nothing
+   ibus_resync: junk and a truncated frame are dropped, the next frames decode
+
+ No receiver needed: the decoder is started without a port (sbus()/ibus()) and the frames are built here. It
+ only uses Serial, so it also runs unchanged in a simulator (see the README).
+*/
+
+#include <Pulse400.h>
+
+Rc400 rc;
+
+uint16_t sbus_value[16];
+uint8_t sbus_buf[RC400_SBUS_FRAME];
+uint8_t ibus_buf[RC400_IBUS_FRAME];
+uint8_t failed = 0;
+
+void check( const char * name, bool ok ) {
+  Serial.print( name );
+  Serial.println( ok ? ",ok" : ",FAIL" );
+  if ( !ok ) failed++;
+}
+
+void sbus_encode( uint8_t flags, uint8_t end ) { // 16 x 11 bit channels, LSB first
+  uint32_t bits = 0;
+  uint8_t cnt = 0;
+  uint8_t pos = 1;
+  sbus_buf[0] = 0x0F;
+  for ( uint8_t ch = 0; ch < 16; ch++ ) {
+    bits |= (uint32_t) sbus_value[ch] << cnt;
+    cnt += 11;
+    while ( cnt >= 8 ) {
+      sbus_buf[pos++] = bits & 0xFF;
+      bits >>= 8;
+      cnt -= 8;
+    }
+  }
+  sbus_buf[23] = flags;
+  sbus_buf[24] = end;
+}
+
+void ibus_encode( uint16_t first ) { // 14 x 16 bit channels, little endian, then the checksum
+  uint16_t sum = 0xFFFF;
+  ibus_buf[0] = 0x20;
+  ibus_buf[1] = 0x40;
+  for ( uint8_t ch = 0; ch < 14; ch++ ) {
+    ibus_buf[2 + ch * 2] = ( first + ch * 70 ) & 0xFF;
+    ibus_buf[3 + ch * 2] = ( first + ch * 70 ) >> 8;
+  }
+  for ( uint8_t i = 0; i < RC400_IBUS_FRAME - 2; i++ ) sum -= ibus_buf[i];
+  ibus_buf[30] = sum & 0xFF;
+  ibus_buf[31] = sum >> 8;
+}
+
+uint8_t feed( const uint8_t * buf, uint8_t len ) { // Frames completed, a frame must complete on its last byte
+  uint8_t frames = 0;
+  for ( uint8_t i = 0; i < len; i++ ) {
+    if ( rc.parse( buf[i] ) ) frames++;
+  }
+  return frames;
+}
+
+bool sbus_expect( void ) {
+  for ( uint8_t ch = 0; ch < 16; ch++ ) {
+    if ( rc.read( ch ) != 880 + ( sbus_value[ch] * 5 + 4 ) / 8 ) return false;
+  }
+  return true;
+}
+
+bool ibus_expect( uint16_t first ) {
+  for ( uint8_t ch = 0; ch < 14; ch++ ) {
+    if ( rc.read( ch ) != first + ch * 70 ) return false;
+  }
+  return rc.read( 14 ) == -1;
+}
+
+void setup() {
+  Serial.begin( 115200 );
+  while ( !Serial );
+  Serial.println( "check,result" );
+
+  rc.sbus();
+  for ( uint8_t ch = 0; ch < 16; ch++ ) sbus_value[ch] = 172 + ch * 109; // Every bit position of the packing
+  sbus_encode( 0, 0x00 );
+  bool ok = feed( sbus_buf, RC400_SBUS_FRAME ) == 1 && sbus_expect() && rc.connected();
+  sbus_value[0] = 172;
+  sbus_value[1] = 992;
+  sbus_value[2] = 1811;
+  sbus_encode( 0, 0x14 ); // SBUS2 telemetry slot end byte
+  ok = ok && feed( sbus_buf, RC400_SBUS_FRAME ) == 1 && rc.read( 0 ) == 988 && rc.read( 1 ) == 1500 && rc.read( 2 ) == 2012;
+  check( "sbus_frame", ok );
+
+  uint8_t junk[] = { 0x00, 0x55, 0xFF, 0x0F, 0x12, 0x0F, 0x00 };
+  sbus_value[3] = 1500;
+  sbus_encode( 0, 0x00 );
+  ok = feed( junk, sizeof( junk ) ) == 0 && feed( sbus_buf, 10 ) == 0; // Junk and a truncated frame
+  sbus_buf[24] = 0x55; // Bad end byte
+  ok = ok && feed( sbus_buf, RC400_SBUS_FRAME ) == 0;
+  sbus_value[3] = 1000;
+  sbus_encode( 0, 0x00 );
+  ok = ok && feed( sbus_buf, RC400_SBUS_FRAME ) == 1 && sbus_expect(); // Found in the bytes after the bad frame
+  ok = ok && feed( sbus_buf, RC400_SBUS_FRAME ) == 1; // And stays in step
+  check( "sbus_resync", ok );
+
+  delay( RC400_IDLE_DISCONNECT / 1000 + 10 );
+  sbus_value[0] = 1811;
+  sbus_encode( 0x08, 0x00 ); // Failsafe: the old values stay
+  ok = feed( sbus_buf, RC400_SBUS_FRAME ) == 1 && rc.read( 0 ) == 988 && !rc.connected();
+  sbus_encode( 0, 0x00 );
+  ok = ok && feed( sbus_buf, RC400_SBUS_FRAME ) == 1 && rc.read( 0 ) == 2012 && rc.connected();
+  check( "sbus_failsafe", ok );
+
+  rc.ibus();
+  ibus_encode( 1000 );
+  ok = feed( ibus_buf, RC400_IBUS_FRAME ) == 1 && ibus_expect( 1000 );
+  check( "ibus_frame", ok );
+
+  ibus_encode( 1100 );
+  ibus_buf[5] ^= 0x01; // Flipped bit
+  ok = feed( ibus_buf, RC400_IBUS_FRAME ) == 0 && ibus_expect( 1000 );
+  ibus_encode( 1100 );
+  ibus_buf[31] ^= 0x80; // Bad checksum
+  ok = ok && feed( ibus_buf, RC400_IBUS_FRAME ) == 0 && ibus_expect( 1000 );
+  ibus_encode( 1100 );
+  ibus_buf[1] = 0x41; // Not a channel frame
+  ok = ok && feed( ibus_buf, RC400_IBUS_FRAME ) == 0 && ibus_expect( 1000 );
+  check( "ibus_checksum", ok );
+
+  uint8_t ibus_junk[] = { 0x20, 0x55, 0x20, 0x40, 0x01 };
+  ibus_encode( 1200 );
+  ok = feed( ibus_junk, sizeof( ibus_junk ) ) == 0 && feed( ibus_buf, 12 ) == 0;
+  ok = ok && feed( ibus_buf, RC400_IBUS_FRAME ) == 1 && ibus_expect( 1200 );
+  ok = ok && feed( ibus_buf, RC400_IBUS_FRAME ) == 1;
+  check( "ibus_resync", ok );
+
+  Serial.println( failed ? "FAIL" : "PASS" );
+}
+
+void loop() {
+}
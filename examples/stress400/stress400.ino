@@ -0,0 +1,101 @@
+/*
+ Pulse400 stress test
+
+ Hammers the generator with random updates at increasing rates (single channel pulse() calls and
+ bursts of pulse( ..., true ) followed by update()) and checks the queue invariants (sorted, every
+ channel present once, sentinel) with verify() whenever the loop sees a new frame. The update timing is
+ jittered randomly so the generator's interrupt lands on a different point in the update code each time.
+
+ This only samples the queues between updates, it doesn't see the pulses: a frame output from a queue
+ that was wrong while it ran but fixed by the time of the check passes. The host simulator in
+ extras/host runs the same load with the interrupt injected at every instruction boundary and checks
+ the edges of every frame.
+
+ Prints a CSV table over Serial:
+
+   rate: requested updates per second
+   achieved: updates per second actually performed (lower than rate when the CPU is saturated)
+   frames: frames generated during the run
+   checked: frames that were checked (lower than frames when the loop can't keep up)
+   errors: checks that found a broken queue
+
+ The last line reports the highest achieved update rate at which every queue check passed.
+*/
+
+#include <Pulse400.h>
+
+#define STEP_DURATION 2000000UL // Microseconds per rate step
+#define CHANNELS 8
+
+Pulse400 pulse400;
+
+int8_t pin[CHANNELS] = { 2, 3, 4, 5, 6, 7, 8, 9 };
+int8_t id[CHANNELS];
+
+uint32_t rate[] = { 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000 };
+
+uint32_t updates, frames, checked, errors;
+
+void hammer( void ) {
+  if ( random( 4 ) ) { // Single channel update
+    pulse400.pulse( id[random( CHANNELS )], random( 1000, 2001 ) );
+  } else { // Bank update
+    int cnt = random( 1, CHANNELS + 1 );
+    for ( int i = 0; i < cnt; i++ ) {
+      pulse400.pulse( id[random( CHANNELS )], random( 1000, 2001 ), true );
+      delayMicroseconds( random( 4 ) );
+    }
+    pulse400.update();
+  }
+  updates++;
+}
+
+void run( uint32_t rate ) {
+  uint32_t interval = 1000000UL / rate;
+  uint32_t start = micros();
+  uint32_t next = start;
+  uint16_t last_frame = pulse400.frames();
+  updates = frames = checked = errors = 0;
+  while ( micros() - start < STEP_DURATION ) {
+    if ( (int32_t)( micros() - next ) >= 0 ) {
+      next += interval;
+      delayMicroseconds( random( 8 ) ); // Shift the preemption point
+      hammer();
+    }
+    uint16_t frame = pulse400.frames();
+    if ( frame != last_frame ) {
+      frames += (uint16_t)( frame - last_frame );
+      last_frame = frame;
+      checked++;
+      if ( !pulse400.verify() ) errors++;
+    }
+  }
+}
+
+void setup() {
+  Serial.begin( 115200 );
+  while ( !Serial );
+  randomSeed( analogRead( 0 ) );
+  for ( int ch = 0; ch < CHANNELS; ch++ ) {
+    id[ch] = pulse400.attach( pin[ch] );
+  }
+  delay( 100 );
+  uint32_t best = 0;
+  Serial.println( "rate,achieved,frames,checked,errors" );
+  for ( unsigned int r = 0; r < sizeof( rate ) / sizeof( rate[0] ); r++ ) {
+    run( rate[r] );
+    uint32_t achieved = updates * 1000000UL / STEP_DURATION;
+    Serial.print( rate[r] ); Serial.print( ',' );
+    Serial.print( achieved ); Serial.print( ',' );
+    Serial.print( frames ); Serial.print( ',' );
+    Serial.print( checked ); Serial.print( ',' );
+    Serial.println( errors );
+    if ( errors == 0 && achieved > best ) best = achieved;
+    if ( errors || achieved < rate[r] * 9 / 10 ) break; // Failed or saturated: no point going faster
+  }
+  Serial.print( "max_verified_rate," );
+  Serial.println( best );
+}
+
+void loop() {
+}
@@ -0,0 +1,28 @@
+/*
+ Pulse400 telemetry
+
+ Logs the output pulse widths, the RC inputs and the generator counters of every 4th frame in binary
+ form without blocking the control loop. Decode the output on the host with extras/telemetry400.py:
+
+   python3 extras/telemetry400.py /dev/ttyACM0 115200
+*/
+
+#include <Pulse400.h>
+
+Pulse400 pulse400;
+Multi400 motors( pulse400 );
+Rc400 rc;
+Telemetry400 telemetry;
+
+void setup() {
+  Serial.begin( 115200 );
+  motors.begin( 4, 5, 6, 7 );
+  rc.pwm( 8, 9, 10, 11 );
+  telemetry.begin( pulse400, &rc, 4 ); // 100 records per second at 400 Hz
+}
+
+void loop() {
+  int16_t throttle = rc.read( 0 ) > 0 ? map( rc.read( 0 ), 1000, 2000, 0, 1000 ) : 0;
+  motors.set( throttle, throttle, throttle, throttle );
+  telemetry.drain( Serial ); // Never blocks, writes what fits in the serial buffer
+}
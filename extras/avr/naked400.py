@@ -0,0 +1,388 @@
+#!/usr/bin/env python3
+"""
+Instruction level check of the PULSE400_AVR_NAKED assembly ISR (TIMER1_COMPA_vect in src/hw/avr_atmega328p.cpp)
+
+Runs the ISR's instructions on a model of the ATmega328P registers, data memory, ports and Timer1 (TCNT1 counts
+at F_CPU / 8 while the ISR runs) and checks every run against what the C++ ISR does for the same group:
+
+  - the group's pins_low cleared on PORTB, PORTC and PORTD, no other output bit touched
+  - OCR1A = OCR1A + step, or TCNT1 + PULSE400_NAKED_LEAD when that is already too close (pulse400_compare())
+  - GPIOR1/2 moved to the next group, GPIOR0 bit 0 cleared when that group has no step
+  - r0-r31, SREG and the stack pointer restored
+
+Cycles come from executing the path each run actually takes, with the ATmega328P timings of the AVR instruction
+set manual: 4 cycles to accept the interrupt, 3 for the jmp in the vector table, 4 for reti.
+
+Usage:
+
+  naked400.py                     the ISR as written in the source (operands from Pulse400.h / avr/io.h)
+  naked400.py --objdump dump.txt  the compiled ISR: avr-objdump -d of the UNO build with PULSE400_AVR_NAKED
+  naked400.py --runs 100000       random groups per check (default 20000)
+
+Exits 1 if any run differs from the C++ ISR.
+"""
+
+import os
+import random
+import re
+import sys
+
+HERE = os.path.dirname( os.path.abspath( __file__ ) )
+SOURCE = os.path.join( HERE, '../../src/hw/avr_atmega328p.cpp' )
+HEADER = os.path.join( HERE, '../../src/Pulse400.h' )
+
+IO = { 'gpior0': 0x1E, 'gpior1': 0x2A, 'gpior2': 0x2B, 'portb': 0x05, 'portc': 0x08, 'portd': 0x0B } # I/O space
+MEM = { 'ocr1al': 0x88, 'ocr1ah': 0x89, 'tcnt1l': 0x84, 'tcnt1h': 0x85 } # Data space
+SREG = 0x3F
+ENTRY = 4 + 3 # Interrupt response + jmp in the vector table
+ENTRY_SIZE = 9 # sizeof( queue_struct_t ), checked by a static_assert in Pulse400.h
+ENTRY_STEP = 7
+
+TWO_WORDS = ( 'jmp', 'call', 'lds', 'sts' )
+CYCLES = { 'push': 2, 'pop': 2, 'in': 1, 'out': 1, 'ldd': 2, 'lds': 2, 'sts': 2, 'com': 1, 'and': 1, 'or': 1,
+           'add': 1, 'adc': 1, 'cp': 1, 'cpc': 1, 'dec': 1, 'movw': 1, 'adiw': 2, 'jmp': 3, 'cbi': 2, 'sbi': 2,
+           'reti': 4, 'mov': 1, 'ldi': 1, 'eor': 1, 'sub': 1, 'sbc': 1, 'inc': 1, 'tst': 1, 'nop': 1,
+           'sbis': 1, 'brne': 1, 'breq': 1, 'brpl': 1, 'brmi': 1, 'brcc': 1, 'brcs': 1, 'brsh': 1, 'brlo': 1 } # Skips/branches: + taken
+
+
+def header_define( name ):
+  m = re.search( r'#define\s+' + name + r'\s+(\d+)', open( HEADER ).read() )
+  return int( m.group( 1 ) )
+
+
+LEAD = header_define( 'PULSE400_NAKED_LEAD' )
+
+# Instruction lists: [ ( address in bytes, mnemonic, operands ) ], branch targets as byte addresses
+
+def from_source():
+  src = open( SOURCE ).read()
+  body = src[src.index( 'ISR( TIMER1_COMPA_vect' ):]
+  body = body[body.index( 'asm volatile' ):body.index( '::' )]
+  ops = dict( IO )
+  ops.update( MEM )
+  ops['lead'] = LEAD
+  ops['size'] = ENTRY_SIZE
+  lines = []
+  for line in re.findall( r'"([^"]*)"', body ):
+    line = line.replace( '\\n', '' ).replace( '\\t', '' ).strip()
+    line = re.sub( r'%\[(\w+)\]', lambda m: str( ops[m.group( 1 )] ), line ).replace( '__SREG__', str( SREG ) )
+    if line:
+      lines.append( line )
+  code, labels, addr = [], [], 0
+  for line in lines:
+    m = re.match( r'(\d+):$', line )
+    if m:
+      labels.append( ( int( m.group( 1 ) ), addr ) )
+      continue
+    mnem, _, rest = line.partition( ' ' )
+    code.append( [addr, mnem, [o.strip() for o in rest.split( ',' )] if rest.strip() else []] )
+    addr += 4 if mnem in TWO_WORDS else 2
+  for ins in code: # GNU as local labels: 1f is the next 1: after the instruction, 1b the last one before it
+    for i, o in enumerate( ins[2] ):
+      m = re.match( r'(\d+)([fb])$', o )
+      if m:
+        n, d = int( m.group( 1 ) ), m.group( 2 )
+        cand = [a for l, a in labels if l == n and ( a > ins[0] if d == 'f' else a <= ins[0] )]
+        ins[2][i] = str( cand[0] if d == 'f' else cand[-1] )
+      elif ins[1] == 'jmp':
+        ins[2][i] = 'slow'
+  return code
+
+
+def from_objdump( path ):
+  code, inside = [], False
+  for line in open( path ):
+    if re.match( r'[0-9a-f]+ <__vector_11>:', line ):
+      inside = True
+      continue
+    if inside:
+      m = re.match( r'\s*([0-9a-f]+):\s+((?:[0-9a-f]{2} )+)\s*(\w+)\s*([^;]*)', line )
+      if not m:
+        if code:
+          break
+        continue
+      addr, size, mnem = int( m.group( 1 ), 16 ), len( m.group( 2 ).split() ), m.group( 3 )
+      opnds = [o.strip() for o in m.group( 4 ).split( ',' )] if m.group( 4 ).strip() else []
+      for i, o in enumerate( opnds ):
+        r = re.match( r'\.([+-]\d+)$', o )
+        if r:
+          opnds[i] = str( addr + size + int( r.group( 1 ) ) )
+      if mnem == 'jmp':
+        opnds = ['slow']
+      code.append( [addr, mnem, opnds] )
+  if not code:
+    sys.exit( 'no __vector_11 in ' + path )
+  base = code[0][0]
+  for ins in code: # Relative to the vector
+    ins[0] -= base
+    if ins[1][:2] in ( 'br', 'rj' ):
+      ins[2][-1] = str( int( ins[2][-1] ) - base )
+  return code
+
+
+def num( s ):
+  return int( s, 0 )
+
+
+def reg( s ):
+  return int( s[1:] )
+
+
+class Avr:
+
+  def __init__( self, tcnt ):
+    self.mem = bytearray( 0x900 ) # r0-r31, I/O, extended I/O, SRAM
+    self.flags = dict.fromkeys( 'ITHSVNZC', 0 )
+    self.sp = 0x8FF
+    self.cycle = 0
+    self.tcnt0 = tcnt # TCNT1 when the interrupt was accepted
+    self.tcnt_read = None # TCNT1 as the ISR read it
+    self.temp = 0 # 16 bit register access latch
+
+  def tcnt( self ):
+    return ( self.tcnt0 + self.cycle // 8 ) & 0xFFFF
+
+  def sreg( self ):
+    return sum( self.flags[f] << ( 7 - i ) for i, f in enumerate( 'ITHSVNZC' ) )
+
+  def set_sreg( self, v ):
+    for i, f in enumerate( 'ITHSVNZC' ):
+      self.flags[f] = ( v >> ( 7 - i ) ) & 1
+
+  def read( self, a ):
+    if a == 0x20 + SREG:
+      return self.sreg()
+    if a == MEM['tcnt1l']:
+      t = self.tcnt_read = self.tcnt()
+      self.temp = t >> 8
+      return t & 0xFF
+    if a == MEM['tcnt1h']:
+      return self.temp
+    return self.mem[a]
+
+  def write( self, a, v ):
+    v &= 0xFF
+    if a == 0x20 + SREG:
+      self.set_sreg( v )
+    elif a == MEM['ocr1ah']:
+      self.temp = v
+    elif a == MEM['ocr1al']:
+      self.mem[MEM['ocr1al']] = v
+      self.mem[MEM['ocr1ah']] = self.temp
+    else:
+      self.mem[a] = v
+
+  def push( self, v ):
+    self.mem[self.sp] = v
+    self.sp -= 1
+
+  def pop( self ):
+    if self.sp >= 0x8FF:
+      raise RuntimeError( 'stack underflow' )
+    self.sp += 1
+    return self.mem[self.sp]
+
+  def logic( self, r ):
+    self.flags.update( V=0, N=r >> 7, Z=int( r == 0 ) )
+    self.flags['S'] = self.flags['N'] ^ self.flags['V']
+
+  def arith( self, d, s, c, sub, keep_z=False ):
+    r = ( d - s - c if sub else d + s + c ) & 0xFF
+    if sub:
+      self.flags['C'] = int( d < s + c )
+      self.flags['V'] = ( ( d ^ s ) & ( d ^ r ) ) >> 7 & 1
+      self.flags['H'] = int( ( d & 0xF ) < ( s & 0xF ) + c )
+    else:
+      self.flags['C'] = int( d + s + c > 0xFF )
+      self.flags['V'] = ( ~( d ^ s ) & ( d ^ r ) ) >> 7 & 1
+      self.flags['H'] = int( ( d & 0xF ) + ( s & 0xF ) + c > 0xF )
+    self.flags['N'] = r >> 7
+    self.flags['Z'] = int( r == 0 ) & ( self.flags['Z'] if keep_z else 1 )
+    self.flags['S'] = self.flags['N'] ^ self.flags['V']
+    return r
+
+  def run( self, code ):
+    """Runs from the vector to reti (returns 'reti') or the jump to the C++ ISR (returns 'slow')"""
+    at = { ins[0]: n for n, ins in enumerate( code ) }
+    m, r = self.mem, reg
+    self.push( 0 ) # Return address
+    self.push( 0 )
+    self.flags['I'] = 0
+    self.cycle = ENTRY
+    self.port_write = {} # Port: cycle its first write completed
+    pc = 0
+    while True:
+      addr, op, o = code[pc]
+      self.cycle += CYCLES[op]
+      nxt = pc + 1
+      if op == 'push': self.push( m[r( o[0] )] )
+      elif op == 'pop': m[r( o[0] )] = self.pop()
+      elif op == 'in': m[r( o[0] )] = self.read( 0x20 + num( o[1] ) )
+      elif op == 'out':
+        self.write( 0x20 + num( o[0] ), m[r( o[1] )] )
+        self.port_write.setdefault( num( o[0] ), self.cycle )
+      elif op == 'ldd':
+        z = m[30] | m[31] << 8
+        m[r( o[0] )] = self.read( z + int( o[1].split( '+' )[1] ) )
+      elif op == 'lds': m[r( o[0] )] = self.read( num( o[1] ) )
+      elif op == 'sts': self.write( num( o[0] ), m[r( o[1] )] )
+      elif op == 'com':
+        v = m[r( o[0] )] ^ 0xFF
+        m[r( o[0] )] = v
+        self.logic( v )
+        self.flags['C'] = 1
+      elif op in ( 'and', 'or', 'eor' ):
+        a, b = m[r( o[0] )], m[r( o[1] )]
+        v = a & b if op == 'and' else a | b if op == 'or' else a ^ b
+        m[r( o[0] )] = v
+        self.logic( v )
+      elif op in ( 'add', 'adc' ):
+        m[r( o[0] )] = self.arith( m[r( o[0] )], m[r( o[1] )], self.flags['C'] if op == 'adc' else 0, False )
+      elif op in ( 'cp', 'cpc' ):
+        self.arith( m[r( o[0] )], m[r( o[1] )], self.flags['C'] if op == 'cpc' else 0, True, op == 'cpc' )
+      elif op == 'dec':
+        v = ( m[r( o[0] )] - 1 ) & 0xFF
+        self.flags['V'] = int( v == 0x7F )
+        m[r( o[0] )] = v
+        self.flags.update( N=v >> 7, Z=int( v == 0 ) )
+        self.flags['S'] = self.flags['N'] ^ self.flags['V']
+      elif op == 'movw':
+        d, s = r( o[0] ), r( o[1] )
+        m[d], m[d + 1] = m[s], m[s + 1]
+      elif op == 'adiw':
+        d = r( o[0] )
+        a = m[d] | m[d + 1] << 8
+        v = ( a + num( o[1] ) ) & 0xFFFF
+        m[d], m[d + 1] = v & 0xFF, v >> 8
+        self.flags['C'] = int( a + num( o[1] ) > 0xFFFF )
+        self.flags['V'] = int( not a & 0x8000 and v & 0x8000 )
+        self.flags.update( N=v >> 15, Z=int( v == 0 ) )
+        self.flags['S'] = self.flags['N'] ^ self.flags['V']
+      elif op in ( 'cbi', 'sbi' ):
+        a = 0x20 + num( o[0] )
+        self.write( a, self.read( a ) & ~( 1 << num( o[1] ) ) if op == 'cbi' else self.read( a ) | 1 << num( o[1] ) )
+      elif op == 'sbis':
+        if self.read( 0x20 + num( o[0] ) ) >> num( o[1] ) & 1:
+          skipped = code[nxt][1]
+          self.cycle += 2 if skipped in TWO_WORDS else 1
+          nxt += 1
+      elif op in ( 'brne', 'breq', 'brpl', 'brmi', 'brcc', 'brcs', 'brsh', 'brlo' ):
+        flag, want = { 'brne': ( 'Z', 0 ), 'breq': ( 'Z', 1 ), 'brpl': ( 'N', 0 ), 'brmi': ( 'N', 1 ),
+                       'brcc': ( 'C', 0 ), 'brsh': ( 'C', 0 ), 'brcs': ( 'C', 1 ), 'brlo': ( 'C', 1 ) }[op]
+        if self.flags[flag] == want:
+          self.cycle += 1
+          nxt = at[int( o[0] )]
+      elif op == 'jmp':
+        return 'slow'
+      elif op == 'reti':
+        self.pop()
+        self.pop()
+        self.flags['I'] = 1
+        return 'reti'
+      else:
+        sys.exit( 'naked400.py: instruction not modelled: ' + op )
+      pc = nxt
+
+
+QUEUE = 0x300 # Where the test queue lives in SRAM
+STACK = 0x880 # From here up: the stack, scratch for the ISR
+
+
+def check( code, rnd, cnt, step, next_step, late, fail ):
+  """One armed run: group of cnt pins at the queue head, returns the Avr after the run"""
+  ocr = rnd.randrange( 0x10000 )
+  avr = Avr( ( ocr + late ) & 0xFFFF )
+  m = avr.mem
+  for i in range( 32 ):
+    m[i] = rnd.randrange( 256 )
+  regs = bytes( m[0:32] )
+  sreg = rnd.randrange( 256 ) | 0x80
+  avr.set_sreg( sreg )
+  head = QUEUE + ENTRY_SIZE * rnd.randrange( 4 )
+  low = [rnd.randrange( 256 ) for _ in range( 3 )]
+  for e in range( cnt ):
+    a = head + e * ENTRY_SIZE
+    m[a + 1] = cnt - e
+    m[a + 4:a + 7] = bytes( low )
+    m[a + ENTRY_STEP] = step & 0xFF
+    m[a + ENTRY_STEP + 1] = step >> 8
+  nxt = head + cnt * ENTRY_SIZE
+  m[nxt + ENTRY_STEP] = next_step & 0xFF
+  m[nxt + ENTRY_STEP + 1] = next_step >> 8
+  ports = [rnd.randrange( 256 ) for _ in range( 3 )]
+  for p, v in zip( ( 'portb', 'portc', 'portd' ), ports ):
+    m[0x20 + IO[p]] = v
+  m[MEM['ocr1al']], m[MEM['ocr1ah']] = ocr & 0xFF, ocr >> 8
+  gpior0 = 3 | rnd.randrange( 256 ) & 0xFC # RUN | INDEX, the other bits must survive
+  m[0x20 + IO['gpior0']] = gpior0
+  m[0x20 + IO['gpior1']], m[0x20 + IO['gpior2']] = head & 0xFF, head >> 8
+  before = bytes( m )
+  try:
+    if avr.run( code ) != 'reti':
+      fail( 'armed ISR jumped to the C++ ISR' )
+      return avr
+  except RuntimeError as e:
+    fail( str( e ) )
+    return avr
+  want = {}
+  for p, v, l in zip( ( 'portb', 'portc', 'portd' ), ports, low ):
+    want[0x20 + IO[p]] = v & ~l & 0xFF
+  tick = avr.tcnt_read
+  ocr_new = ( ocr + step ) & 0xFFFF if step > ( ( tick - ocr ) & 0xFFFF ) + LEAD else ( tick + LEAD ) & 0xFFFF # pulse400_compare()
+  want[MEM['ocr1al']], want[MEM['ocr1ah']] = ocr_new & 0xFF, ocr_new >> 8
+  want[0x20 + IO['gpior1']], want[0x20 + IO['gpior2']] = nxt & 0xFF, nxt >> 8
+  want[0x20 + IO['gpior0']] = gpior0 if next_step else gpior0 & ~1
+  for a in range( STACK ):
+    exp = want.get( a, regs[a] if a < 32 else before[a] )
+    if m[a] != exp:
+      fail( 'address 0x%03x: 0x%02x, C++ ISR: 0x%02x (cnt %d, step %d, late %d)' % ( a, m[a], exp, cnt, step, late ) )
+      break
+  if avr.sreg() != sreg or avr.sp != 0x8FF:
+    fail( 'SREG or SP not restored' )
+  return avr
+
+
+def main():
+  args = sys.argv[1:]
+  runs = 20000
+  code = None
+  while args:
+    a = args.pop( 0 )
+    if a == '--objdump':
+      code = from_objdump( args.pop( 0 ) )
+    elif a == '--runs':
+      runs = int( args.pop( 0 ) )
+    else:
+      sys.exit( __doc__ )
+  if code is None:
+    code = from_source()
+
+  errors = []
+
+  def fail( msg ):
+    if len( errors ) < 5:
+      print( 'error,' + msg )
+    errors.append( msg )
+
+  rnd = random.Random( 400 )
+  min_step = header_define( 'PULSE400_NAKED_MIN_STEP' ) * 2
+  max_step = header_define( 'PULSE400_NAKED_MAX_STEP' ) * 2
+  for i in range( runs ): # Steps in the range init_steps() produces, late by whatever the interrupt latency was
+    step = rnd.randrange( min_step, max_step + 1 )
+    late = rnd.choice( ( rnd.randrange( 0, 16 ), rnd.randrange( 0, 4000 ), step - LEAD + rnd.randrange( -40, 40 ) ) )
+    check( code, rnd, rnd.randrange( 1, 9 ), step, rnd.choice( ( 0, step ) ), max( late, 0 ), fail )
+
+  print( 'path,cnt,cycles,portb_cycle' ) # Cycles from accepting the interrupt, incl. ENTRY and reti
+  for cnt in range( 1, 9 ):
+    for name, next_step, late in ( ( 'group', min_step, 0 ), ( 'handback', 0, 0 ), ( 'late', min_step, min_step ) ):
+      avr = check( code, random.Random( cnt ), cnt, min_step, next_step, late, fail )
+      print( '%s,%d,%d,%d' % ( name, cnt, avr.cycle, avr.port_write.get( IO['portb'], -1 ) ) )
+  avr = Avr( 0 ) # Not armed
+  avr.mem[0x20 + IO['gpior0']] = 0
+  print( 'unarmed,0,%d,-1' % ( avr.cycle if avr.run( code ) == 'slow' else -1 ) )
+  print( 'runs,%d\nerrors,%d' % ( runs, len( errors ) ) )
+  sys.exit( 1 if errors else 0 )
+
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Builds trace400 for the UNO with the fast queue layout, once with the C++ ISR and once with PULSE400_AVR_NAKED,
+# runs both in simavr with PORTB/PORTD traced to VCD, compares the pulses (vcd400.py) and checks the compiled
+# assembly ISR instruction by instruction with its cycle counts (naked400.py --objdump)
+# Needs arduino-cli with the arduino:avr core, simavr's run_avr and avr-objdump (comes with the core) on the PATH
+
+cd "$( dirname "$0" )"
+OUT=${TMPDIR:-/tmp}/trace400
+mkdir -p $OUT
+for V in cxx naked; do
+  FLAGS="-DPULSE400_QUEUE_FAST"
+  [ $V = naked ] && FLAGS="$FLAGS -DPULSE400_AVR_NAKED"
+  arduino-cli compile -b arduino:avr:uno --library ../.. --build-property "compiler.cpp.extra_flags=$FLAGS" \
+    --output-dir $OUT/$V trace400 > $OUT/$V.log 2>&1 || { cat $OUT/$V.log; exit 1; }
+  run_avr -m atmega328p -f 16000000 -o $OUT/$V.vcd \
+    --add-trace portb=trace@0x25/0xff --add-trace portd=trace@0x2b/0xff $OUT/$V/trace400.ino.elf > $OUT/$V.run 2>&1
+done
+avr-objdump -d $OUT/naked/trace400.ino.elf > $OUT/naked.lst
+python3 vcd400.py $OUT/cxx.vcd $OUT/naked.vcd || STATUS=1
+python3 naked400.py --objdump $OUT/naked.lst || STATUS=1
+exit ${STATUS:-0}
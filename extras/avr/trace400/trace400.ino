@@ -0,0 +1,49 @@
+/*
+ Pulse400 trace sketch for simavr (see ../trace400.sh)
+
+ Outputs a fixed sequence of pulse width sets on pins 2-9 of an UNO, FRAMES frames each, then stops the CPU so
+ the simulator exits. The sets cover the falling edge paths of both ISRs: one group of eight, groups of two and
+ four, evenly spread pins, pins closer together than PULSE400_NAKED_MIN_STEP (left to the C++ ISR) and a timed
+ event between two groups. Built with and without PULSE400_AVR_NAKED the pin traces must match.
+*/
+
+#include <Pulse400.h>
+#include <avr/sleep.h>
+
+#define FRAMES 20 // Frames per set
+#define CHANNELS 8
+
+Pulse400 pulse400;
+
+int8_t pin[CHANNELS] = { 2, 3, 4, 5, 6, 7, 8, 9 };
+int8_t id[CHANNELS];
+
+const uint16_t set[][CHANNELS] = {
+  { 1500, 1500, 1500, 1500, 1500, 1500, 1500, 1500 }, // One group
+  { 1100, 1100, 1300, 1300, 1500, 1500, 1700, 1700 }, // Groups of two
+  { 1200, 1200, 1200, 1200, 1800, 1800, 1800, 1800 }, // Groups of four
+  { 1100, 1200, 1300, 1400, 1500, 1600, 1700, 1800 }, // Spread
+  { 1400, 1406, 1412, 1418, 1424, 1430, 1436, 1442 }, // Closer than PULSE400_NAKED_MIN_STEP
+  { 1950, 1100, 1875, 1175, 1800, 1250, 1725, 1325 }, // Spread, channel order reversed
+};
+
+void setup() {
+  pulse400.attachAll( pin, CHANNELS, id );
+  pulse400.frequency( 400 );
+  for ( uint8_t s = 0; s < sizeof( set ) / sizeof( set[0] ); s++ ) {
+    if ( s == sizeof( set ) / sizeof( set[0] ) - 1 ) {
+      pulse400.event( 10, PULSE400_EDGE_TOGGLE, 1500 ); // A timed event between two groups
+    }
+    for ( uint8_t ch = 0; ch < CHANNELS; ch++ ) pulse400.pulse( id[ch], set[s][ch], true );
+    pulse400.update();
+    uint16_t start = pulse400.frames();
+    while ( (uint16_t)( pulse400.frames() - start ) < FRAMES );
+  }
+  for ( uint8_t ch = 0; ch < CHANNELS; ch++ ) pulse400.detach( id[ch] );
+  cli(); // simavr exits when the CPU sleeps with interrupts off
+  sleep_enable();
+  sleep_cpu();
+}
+
+void loop() {
+}
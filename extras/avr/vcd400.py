@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""
+Compares the pin traces of two simavr runs of trace400 (see trace400.sh)
+
+Reads the PORTB and PORTD traces from two VCD files, pairs the pulses of every pin (2-10) in order and prints
+one CSV line per pin:
+
+  pin,pulses,max_width_diff_us,max_period_diff_us
+
+Exits 1 if a pin has a different number of pulses or a width or period differs by more than the tolerance
+(default 2 us, --tolerance us).
+
+Usage:
+
+  vcd400.py cxx.vcd naked.vcd [--tolerance us]
+"""
+
+import re
+import sys
+
+PINS = { 'portd': { 2: 2, 3: 3, 4: 4, 5: 5, 6: 6, 7: 7 }, 'portb': { 0: 8, 1: 9, 2: 10 } } # Port: bit -> UNO pin
+
+
+def pulses( path ):
+  """Returns { pin: [ ( rise_ns, fall_ns ) ] }"""
+  ids, scale, t = {}, 1, 0
+  level = {}
+  rise = {}
+  out = {}
+  for line in open( path ):
+    line = line.strip()
+    m = re.match( r'\$timescale\s+(\d+)\s*(\w+)', line )
+    if m:
+      scale = int( m.group( 1 ) ) * { 's': 10**9, 'ms': 10**6, 'us': 1000, 'ns': 1, 'ps': 0.001 }[m.group( 2 )]
+    m = re.match( r'\$var\s+\w+\s+\d+\s+(\S+)\s+(\w+)', line )
+    if m and m.group( 2 ).lower() in PINS:
+      ids[m.group( 1 )] = m.group( 2 ).lower()
+    if line.startswith( '#' ):
+      t = int( line[1:] ) * scale
+    m = re.match( r'b([01xz]+)\s+(\S+)', line )
+    if m and m.group( 2 ) in ids:
+      port = ids[m.group( 2 )]
+      v = int( m.group( 1 ).replace( 'x', '0' ).replace( 'z', '0' ), 2 )
+      for bit, pin in PINS[port].items():
+        new = v >> bit & 1
+        if new != level.get( pin, 0 ):
+          if new:
+            rise[pin] = t
+          elif pin in rise:
+            out.setdefault( pin, [] ).append( ( rise.pop( pin ), t ) )
+          level[pin] = new
+  return out
+
+
+def main():
+  args = sys.argv[1:]
+  tolerance = 2
+  if '--tolerance' in args:
+    i = args.index( '--tolerance' )
+    tolerance = float( args[i + 1] )
+    del args[i:i + 2]
+  if len( args ) != 2:
+    sys.exit( __doc__ )
+  a, b = pulses( args[0] ), pulses( args[1] )
+  ok = True
+  print( 'pin,pulses,max_width_diff_us,max_period_diff_us' )
+  for pin in sorted( set( a ) | set( b ) ):
+    pa, pb = a.get( pin, [] ), b.get( pin, [] )
+    if len( pa ) != len( pb ) or not pa:
+      print( '%d,%d/%d,,' % ( pin, len( pa ), len( pb ) ) )
+      ok = False
+      continue
+    width = max( abs( ( fa - ra ) - ( fb - rb ) ) for ( ra, fa ), ( rb, fb ) in zip( pa, pb ) ) / 1000
+    period = max( [abs( ( pa[i + 1][0] - pa[i][0] ) - ( pb[i + 1][0] - pb[i][0] ) ) for i in range( len( pa ) - 1 )] or [0] ) / 1000
+    print( '%d,%d,%.2f,%.2f' % ( pin, len( pa ), width, period ) )
+    ok = ok and width <= tolerance and period <= tolerance
+  sys.exit( 0 if ok else 1 )
+
+
+if __name__ == '__main__':
+  main()
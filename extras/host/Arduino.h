@@ -0,0 +1,186 @@
+#pragma once
+
+// Minimal Arduino core for building Pulse400 on a Linux/x86-64 host (see host400.h)
+// Covers what the library uses on the generic, UNO and Teensy 3.x code paths, nothing more
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define F_CPU 16000000UL
+
+#define constrain( amt, low, high ) ( ( amt ) < ( low ) ? ( low ) : ( ( amt ) > ( high ) ? ( high ) : ( amt ) ) )
+#define bit( b ) ( 1UL << ( b ) )
+template <class T, class U> static inline auto min( T a, U b ) -> decltype( a + b ) { return a < b ? a : b; }
+template <class T, class U> static inline auto max( T a, U b ) -> decltype( a + b ) { return a > b ? a : b; }
+static inline long map( long x, long in_min, long in_max, long out_min, long out_max ) {
+  return ( x - in_min ) * ( out_max - out_min ) / ( in_max - in_min ) + out_min;
+}
+
+extern volatile bool host_int_enabled; // Global interrupt flag
+static inline void cli( void ) { host_int_enabled = false; }
+static inline void sei( void ) { host_int_enabled = true; }
+#define noInterrupts() cli()
+#define interrupts() sei()
+
+uint32_t micros( void );
+uint32_t millis( void );
+void delay( uint32_t ms );
+void delayMicroseconds( uint32_t us );
+void yield( void );
+long random( long a, long b = 0x7FFFFFFFL );
+void randomSeed( unsigned long seed );
+int analogRead( uint8_t pin );
+
+void pinMode( uint8_t pin, uint8_t mode );
+void digitalWrite( uint8_t pin, uint8_t v );
+int digitalRead( uint8_t pin );
+#define digitalPinToInterrupt( p ) ( p )
+void attachInterrupt( int irq, void ( *f )( void ), int mode );
+void detachInterrupt( int irq );
+
+#define PROGMEM
+#define pgm_read_byte( p ) ( *(const uint8_t *)( p ) )
+#define pgm_read_word( p ) ( *(const uint16_t *)( p ) )
+
+class Print {
+  public:
+  virtual size_t write( uint8_t c ) = 0;
+  virtual size_t write( const uint8_t * buf, size_t n ) { size_t r = 0; while ( n-- ) r += write( *buf++ ); return r; }
+  virtual int availableForWrite( void ) { return 0; }
+  size_t print( const char * s ) { return write( (const uint8_t *) s, strlen( s ) ); }
+  size_t print( char c ) { return write( (uint8_t) c ); }
+  size_t print( long v ) { char b[24]; snprintf( b, sizeof( b ), "%ld", v ); return print( b ); }
+  size_t print( unsigned long v ) { char b[24]; snprintf( b, sizeof( b ), "%lu", v ); return print( b ); }
+  size_t print( int v ) { return print( (long) v ); }
+  size_t print( unsigned int v ) { return print( (unsigned long) v ); }
+  size_t print( double v, int d = 2 ) { char b[32]; snprintf( b, sizeof( b ), "%.*f", d, v ); return print( b ); }
+  template <class T> size_t println( T v ) { return print( v ) + print( "\n" ); }
+  size_t println( double v, int d ) { return print( v, d ) + print( "\n" ); }
+  size_t println( void ) { return print( "\n" ); }
+};
+
+class Stream : public Print {
+  public:
+  virtual int available( void ) = 0;
+  virtual int read( void ) = 0;
+  virtual int peek( void ) = 0;
+};
+
+class HardwareSerial : public Stream { // Writes to stdout, never receives
+  public:
+  void begin( unsigned long, uint8_t = 0 ) {}
+  void end( void ) {}
+  int available( void ) { return 0; }
+  int read( void ) { return -1; }
+  int peek( void ) { return -1; }
+  size_t write( uint8_t c ) { putchar( c ); return 1; }
+  int availableForWrite( void ) { return 64; }
+  operator bool() { return true; }
+};
+
+extern HardwareSerial Serial, Serial1;
+
+#define SERIAL_8N1 0x06
+#define SERIAL_8E2 0x2E
+
+// ATmega328P registers: the port ISR writes PORTB-D, Rc400 and the blocking mode use the rest
+
+extern volatile uint8_t PORTB, PORTC, PORTD, DDRB, DDRC, DDRD, PINB, PINC, PIND;
+extern volatile uint8_t PCMSK0, PCMSK1, PCMSK2, PCIFR, PCICR, TIMSK1, TIMSK2, TCCR1A, TCCR1B, TCCR2A, TCCR2B, TCNT2, OCR2A;
+extern volatile uint8_t GPIOR0, GPIOR1, GPIOR2, TIFR1;
+extern volatile uint16_t OCR1A, OCR1B;
+struct host_tcnt1_t { // Free running at 2 MHz (prescaler 8)
+  operator uint16_t() { return (uint16_t)( micros() * 2 ); }
+  host_tcnt1_t& operator=( uint16_t ) { return *this; }
+};
+extern host_tcnt1_t TCNT1;
+
+#define PCIF0 0
+#define PCIF1 1
+#define PCIF2 2
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define WGM12 3
+#define WGM21 1
+#define CS10 0
+#define CS11 1
+#define CS21 1
+#define OCIE1A 1
+#define OCIE1B 2
+#define OCIE2A 1
+#define OCF1A 1
+#define OCF1B 2
+#define ISR( vector, ... ) extern "C" void vector( void )
+
+// Teensy 3.x/LC: GPIO set/clear/toggle registers, IntervalTimer and the software interrupt
+
+#if defined( __MK20DX128__ ) || defined( __MK20DX256__ ) || defined( __MK64FX512__ ) || defined( __MK66FX1M0__ ) || defined( __MKL26Z64__ )
+
+#define HOST_TEENSY
+
+extern uint32_t host_gpio[5]; // Port A-E output data
+struct host_gpio_write_t { // PSOR/PCOR/PTOR: writing a mask sets, clears or toggles those bits
+  uint8_t port;
+  uint8_t op;
+  host_gpio_write_t& operator=( uint32_t v ) {
+    if ( op == 0 ) host_gpio[port] |= v; else if ( op == 1 ) host_gpio[port] &= ~v; else host_gpio[port] ^= v;
+    return *this;
+  }
+};
+extern host_gpio_write_t host_gpio_reg[15];
+#define GPIOA_PSOR host_gpio_reg[0]
+#define GPIOB_PSOR host_gpio_reg[1]
+#define GPIOC_PSOR host_gpio_reg[2]
+#define GPIOD_PSOR host_gpio_reg[3]
+#define GPIOE_PSOR host_gpio_reg[4]
+#define GPIOA_PCOR host_gpio_reg[5]
+#define GPIOB_PCOR host_gpio_reg[6]
+#define GPIOC_PCOR host_gpio_reg[7]
+#define GPIOD_PCOR host_gpio_reg[8]
+#define GPIOE_PCOR host_gpio_reg[9]
+#define GPIOA_PTOR host_gpio_reg[10]
+#define GPIOB_PTOR host_gpio_reg[11]
+#define GPIOC_PTOR host_gpio_reg[12]
+#define GPIOD_PTOR host_gpio_reg[13]
+#define GPIOE_PTOR host_gpio_reg[14]
+
+#define FASTRUN
+#define digitalWriteFast( p, v ) digitalWrite( p, v )
+
+class IntervalTimer {
+  public:
+  bool begin( void ( *f )( void ), uint32_t us );
+  void end( void );
+  void priority( uint8_t ) {}
+};
+
+extern uint32_t ARM_DEMCR, ARM_DWT_CTRL;
+#define ARM_DWT_CYCCNT ( micros() * 16 )
+#define ARM_DEMCR_TRCENA 1
+#define ARM_DWT_CTRL_CYCCNTENA 1
+
+#define IRQ_SOFTWARE 70
+void host_pend_soft( void );
+extern void ( *host_soft_isr )( void );
+#define NVIC_SET_PENDING( n ) host_pend_soft()
+#define NVIC_SET_PRIORITY( n, p )
+#define NVIC_ENABLE_IRQ( n )
+#define attachInterruptVector( n, f ) ( host_soft_isr = ( f ) )
+#define SERIAL_8E2_RXINV 0x2E
+
+#endif
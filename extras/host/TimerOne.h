@@ -0,0 +1,18 @@
+#pragma once
+
+// Host stand-in for the TimerOne library: one-shot periods on the simulated timer (see host400.h)
+
+#include <Arduino.h>
+
+class TimerOne {
+  public:
+  void initialize( long us = 1000000 ) {}
+  void setPeriod( long us );
+  void attachInterrupt( void ( *f )( void ), long us = -1 );
+  void detachInterrupt( void );
+  void restart( void );
+  void start( void );
+  void stop( void );
+};
+
+extern TimerOne Timer1;
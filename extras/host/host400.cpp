@@ -0,0 +1,266 @@
+#include "host400.h"
+#include <TimerOne.h>
+#include <signal.h>
+#include <ucontext.h>
+
+// Arduino core state
+
+volatile bool host_int_enabled = true;
+HardwareSerial Serial, Serial1;
+volatile uint8_t PORTB, PORTC, PORTD, DDRB, DDRC, DDRD, PINB, PINC, PIND;
+volatile uint8_t PCMSK0, PCMSK1, PCMSK2, PCIFR, PCICR, TIMSK1, TIMSK2, TCCR1A, TCCR1B, TCCR2A, TCCR2B, TCNT2, OCR2A;
+volatile uint8_t GPIOR0, GPIOR1, GPIOR2, TIFR1;
+volatile uint16_t OCR1A, OCR1B;
+host_tcnt1_t TCNT1;
+
+static uint64_t now_ns = 0;
+static bool armed = false;
+static uint64_t due_ns = 0;
+static uint32_t period_us = 0;
+static void ( *timer_isr )( void ) = NULL;
+static bool soft_pending = false;
+void ( *host_soft_isr )( void ) = NULL;
+static bool in_isr = false;
+static bool stepping = false;
+static uint32_t step_ns = 0;
+static volatile uint32_t steps = 0;
+static uint64_t step_until = 0;
+static uint64_t latency_max = 0;
+static uint64_t lag_ns = 0;
+
+static host_edge_t edge_log[HOST_EDGES];
+static uint32_t edge_cnt = 0;
+static uint8_t level[HOST_PINS];
+static uint8_t generic_pin[HOST_PINS]; // Generic backend: digitalWrite() levels
+
+static void arm( uint32_t us ) {
+  armed = true;
+  period_us = us;
+  due_ns = now_ns + (uint64_t)( us ? us : 1 ) * 1000;
+}
+
+// Pin levels by backend
+
+#if defined( HOST_TEENSY )
+
+uint32_t host_gpio[5];
+host_gpio_write_t host_gpio_reg[15] = { { 0, 0 }, { 1, 0 }, { 2, 0 }, { 3, 0 }, { 4, 0 }, { 0, 1 }, { 1, 1 }, { 2, 1 }, { 3, 1 }, { 4, 1 },
+  { 0, 2 }, { 1, 2 }, { 2, 2 }, { 3, 2 }, { 4, 2 } };
+uint32_t ARM_DEMCR, ARM_DWT_CTRL;
+
+static const uint8_t teensy_pin[][2] = { // Port, bit
+#if defined( __MKL26Z64__ )
+  { 1, 16 }, { 1, 17 }, { 3, 0 }, { 0, 1 }, { 0, 2 }, { 3, 7 }, { 3, 4 }, { 3, 2 }, { 3, 3 }, { 2, 3 }, { 2, 4 }, { 2, 6 }, { 2, 7 },
+  { 2, 5 }, { 3, 1 }, { 2, 0 }, { 1, 0 }, { 1, 1 }, { 1, 3 }, { 1, 2 }, { 3, 5 }, { 3, 6 }, { 2, 1 }, { 2, 2 }, { 4, 20 }, { 4, 21 },
+  { 4, 30 }
+#elif defined( __MK64FX512__ ) || defined( __MK66FX1M0__ )
+  { 1, 16 }, { 1, 17 }, { 3, 0 }, { 0, 12 }, { 0, 13 }, { 3, 7 }, { 3, 4 }, { 3, 2 }, { 3, 3 }, { 2, 3 }, { 2, 4 }, { 2, 6 }, { 2, 7 },
+  { 2, 5 }, { 3, 1 }, { 2, 0 }, { 1, 0 }, { 1, 1 }, { 1, 3 }, { 1, 2 }, { 3, 5 }, { 3, 6 }, { 2, 1 }, { 2, 2 }, { 4, 26 }, { 0, 5 },
+  { 0, 14 }, { 0, 15 }, { 0, 16 }, { 1, 18 }, { 1, 19 }, { 1, 10 }, { 1, 11 }, { 4, 24 }, { 4, 25 }, { 2, 8 }, { 2, 9 }, { 2, 10 },
+  { 2, 11 }, { 0, 17 }, { 0, 28 }, { 0, 29 }, { 0, 26 }, { 1, 20 }, { 1, 22 }, { 1, 23 }, { 1, 21 }, { 3, 8 }, { 3, 9 }, { 1, 4 },
+  { 1, 5 }, { 3, 14 }, { 3, 13 }, { 3, 12 }, { 3, 15 }, { 3, 11 }, { 4, 10 }, { 4, 11 }
+#else
+  { 1, 16 }, { 1, 17 }, { 3, 0 }, { 0, 12 }, { 0, 13 }, { 3, 7 }, { 3, 4 }, { 3, 2 }, { 3, 3 }, { 2, 3 }, { 2, 4 }, { 2, 6 }, { 2, 7 },
+  { 2, 5 }, { 3, 1 }, { 2, 0 }, { 1, 0 }, { 1, 1 }, { 1, 3 }, { 1, 2 }, { 3, 5 }, { 3, 6 }, { 2, 1 }, { 2, 2 }, { 0, 5 }, { 1, 19 },
+  { 4, 1 }, { 2, 9 }, { 2, 8 }, { 2, 10 }, { 2, 11 }, { 4, 0 }, { 1, 18 }, { 0, 4 }
+#endif
+};
+
+#define TEENSY_PINS ( sizeof( teensy_pin ) / sizeof( teensy_pin[0] ) )
+
+void digitalWrite( uint8_t pin, uint8_t v ) {
+  if ( pin >= TEENSY_PINS ) return;
+  if ( v ) {
+    host_gpio[teensy_pin[pin][0]] |= 1UL << teensy_pin[pin][1];
+  } else {
+    host_gpio[teensy_pin[pin][0]] &= ~( 1UL << teensy_pin[pin][1] );
+  }
+}
+
+int host_pin( uint8_t pin ) {
+  return pin < TEENSY_PINS ? ( host_gpio[teensy_pin[pin][0]] >> teensy_pin[pin][1] ) & 1 : 0;
+}
+
+bool IntervalTimer::begin( void ( *f )( void ), uint32_t us ) {
+  timer_isr = f;
+  arm( us );
+  return true;
+}
+
+void IntervalTimer::end( void ) {
+  armed = false;
+}
+
+void host_pend_soft( void ) {
+  soft_pending = true;
+}
+
+#else
+
+TimerOne Timer1;
+
+void TimerOne::setPeriod( long us ) { arm( us ); }
+void TimerOne::attachInterrupt( void ( *f )( void ), long us ) { timer_isr = f; if ( us > 0 ) arm( us ); }
+void TimerOne::detachInterrupt( void ) { armed = false; }
+void TimerOne::restart( void ) { arm( period_us ); }
+void TimerOne::start( void ) { arm( period_us ); }
+void TimerOne::stop( void ) { armed = false; }
+
+#if defined( __AVR_ATmega328P__ )
+
+static volatile uint8_t * uno_port( uint8_t pin, uint8_t& b ) { // D0-7: PORTD, D8-13: PORTB, A0-5: PORTC
+  b = pin < 8 ? pin : ( pin < 14 ? pin - 8 : pin - 14 );
+  return pin < 8 ? &PORTD : ( pin < 14 ? &PORTB : &PORTC );
+}
+
+void digitalWrite( uint8_t pin, uint8_t v ) {
+  uint8_t b;
+  volatile uint8_t * r = uno_port( pin, b );
+  if ( pin >= 20 ) return;
+  if ( v ) *r |= 1 << b; else *r &= ~( 1 << b );
+}
+
+int host_pin( uint8_t pin ) {
+  uint8_t b;
+  volatile uint8_t * r = uno_port( pin, b );
+  return pin < 20 ? ( *r >> b ) & 1 : 0;
+}
+
+#else
+
+void digitalWrite( uint8_t pin, uint8_t v ) {
+  if ( pin < HOST_PINS ) generic_pin[pin] = v;
+}
+
+int host_pin( uint8_t pin ) {
+  return pin < HOST_PINS ? generic_pin[pin] : 0;
+}
+
+#endif
+#endif
+
+void pinMode( uint8_t, uint8_t ) {}
+int digitalRead( uint8_t pin ) { return host_pin( pin ); }
+void attachInterrupt( int, void ( * )( void ), int ) {}
+void detachInterrupt( int ) {}
+int analogRead( uint8_t ) { return 0; }
+long random( long a, long b ) { if ( b == 0x7FFFFFFFL ) { b = a; a = 0; } return b <= a ? a : a + rand() % ( b - a ); }
+void randomSeed( unsigned long seed ) { srand( seed ); }
+
+// Edge log: compared after every interrupt, the ISRs are the only code that writes the channel pins
+
+static void sample( void ) {
+  for ( uint8_t p = 0; p < HOST_PINS; p++ ) {
+    uint8_t l = host_pin( p );
+    if ( l != level[p] ) {
+      level[p] = l;
+      if ( edge_cnt < HOST_EDGES ) edge_log[edge_cnt++] = { (uint32_t)( now_ns / 1000 ), (uint32_t) lag_ns, p, l };
+    }
+  }
+}
+
+// Runs the interrupts that are due: the timer first, then the (lower priority) Teensy software interrupt
+
+static void service( void ) {
+  if ( in_isr || !host_int_enabled ) return;
+  in_isr = true;
+  while ( armed && due_ns <= now_ns ) {
+    armed = false; // The ISR sets the next interval
+    if ( now_ns - due_ns > latency_max ) latency_max = now_ns - due_ns;
+    lag_ns += now_ns - due_ns; // The next interval is set from here: the delay carries over to the following edges
+    host_int_enabled = false;
+    timer_isr();
+    host_int_enabled = true;
+    sample();
+  }
+  if ( soft_pending && host_soft_isr ) {
+    soft_pending = false;
+    host_soft_isr();
+    host_int_enabled = true;
+    sample();
+  }
+  in_isr = false;
+}
+
+void host_run_until( uint64_t ns ) {
+  sample();
+  while ( armed && due_ns <= ns && host_int_enabled ) {
+    if ( due_ns > now_ns ) now_ns = due_ns;
+    service();
+  }
+  if ( ns > now_ns ) now_ns = ns;
+  service();
+}
+
+void host_run( uint32_t us ) {
+  host_run_until( now_ns + (uint64_t) us * 1000 );
+}
+
+uint32_t micros( void ) { // Time only passes here when the host isn't counting instructions
+  if ( !in_isr && !stepping ) host_run( 1 );
+  return now_ns / 1000;
+}
+
+uint32_t millis( void ) { return micros() / 1000; }
+void delay( uint32_t ms ) { host_run( ms * 1000 ); }
+void delayMicroseconds( uint32_t us ) { if ( !stepping ) host_run( us ); }
+void yield( void ) { if ( !stepping ) host_run( 1 ); }
+
+uint64_t host_now( void ) { return now_ns; }
+bool host_timer_armed( void ) { return armed; }
+uint64_t host_timer_due( void ) { return due_ns; }
+uint32_t host_latency( void ) { return latency_max; }
+host_edge_t * host_edges( void ) { return edge_log; }
+uint32_t host_edge_count( void ) { return edge_cnt; }
+void host_edges_clear( void ) { edge_cnt = 0; }
+
+void host_reset( void ) {
+  now_ns = 0;
+  armed = false;
+  soft_pending = false;
+  host_int_enabled = true;
+  edge_cnt = 0;
+  latency_max = 0;
+  lag_ns = 0;
+  memset( level, 0, sizeof( level ) );
+  memset( generic_pin, 0, sizeof( generic_pin ) );
+  PORTB = PORTC = PORTD = DDRB = DDRC = DDRD = 0;
+  GPIOR0 = GPIOR1 = GPIOR2 = 0;
+#if defined( HOST_TEENSY )
+  memset( host_gpio, 0, sizeof( host_gpio ) );
+#endif
+}
+
+// Instruction stepping: the trap flag raises SIGTRAP after every instruction, the handler advances the time
+// and runs the interrupts that became due at that boundary. The kernel clears the trap flag while the handler
+// (and so the ISR) runs and restores it on return
+
+static void trap( int, siginfo_t *, void * ctx ) {
+  steps++;
+  now_ns += step_ns;
+  service();
+  if ( now_ns >= step_until ) {
+    ( (ucontext_t *) ctx )->uc_mcontext.gregs[REG_EFL] &= ~0x100UL; // Trap flag off from here
+  }
+}
+
+uint32_t host_step( void ( *f )( void ), uint32_t ns_per_instruction, uint64_t until_ns /* = UINT64_MAX */ ) {
+  static bool installed = false;
+  if ( !installed ) {
+    struct sigaction sa;
+    memset( &sa, 0, sizeof( sa ) );
+    sa.sa_sigaction = trap;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction( SIGTRAP, &sa, NULL );
+    installed = true;
+  }
+  step_ns = ns_per_instruction;
+  step_until = until_ns;
+  steps = 0;
+  stepping = true;
+  asm volatile ( "pushfq; orq $0x100, (%%rsp); popfq" ::: "memory", "cc" );
+  f();
+  asm volatile ( "pushfq; andq $~0x100, (%%rsp); popfq" ::: "memory", "cc" );
+  stepping = false;
+  return steps;
+}
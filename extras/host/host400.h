@@ -0,0 +1,38 @@
+#pragma once
+
+// Host simulator for Pulse400: the library and a test program are compiled for Linux/x86-64 against a
+// minimal Arduino core (Arduino.h, TimerOne.h in this directory). Time is simulated in nanoseconds, the
+// timer interrupt runs when it is due and every pin change it makes is logged with its time.
+//
+// host_step() runs a function on a simulated CPU: the x86 trap flag stops the program after every instruction,
+// each instruction takes ns_per_instruction and a timer interrupt that becomes due preempts the function at
+// exactly that instruction boundary (unless interrupts are masked: then right after the sei()). That's how
+// the ISR is injected at every instruction boundary of pulse(), update() and the queue code.
+
+#include <Arduino.h>
+
+#define HOST_PINS 58
+#define HOST_EDGES ( 1UL << 20 )
+
+struct host_edge_t {
+  uint32_t t; // Microseconds
+  uint32_t lag; // Timer interrupt delays (masked interrupts) added up since host_reset(), nanoseconds
+  uint8_t pin;
+  uint8_t level;
+};
+
+void host_reset( void ); // Time 0, timer stopped, pins LOW, empty edge log
+void host_run( uint32_t us ); // Advance the time, running interrupts as they become due
+void host_run_until( uint64_t ns );
+uint64_t host_now( void ); // Nanoseconds
+bool host_timer_armed( void );
+uint64_t host_timer_due( void ); // Nanoseconds
+uint32_t host_latency( void ); // Longest timer interrupt delay (masked interrupts) since host_reset(), nanoseconds
+
+// Returns the instructions counted. From until_ns on the rest of f runs at full speed and takes no time
+uint32_t host_step( void ( *f )( void ), uint32_t ns_per_instruction, uint64_t until_ns = UINT64_MAX );
+
+int host_pin( uint8_t pin );
+host_edge_t * host_edges( void );
+uint32_t host_edge_count( void );
+void host_edges_clear( void );
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Builds the library with the host simulator for the generic, UNO and Teensy 3.2 code paths and runs a test
+# program on each, in parallel: sh run.sh [program.cpp [args]], default stress400.cpp
+# NS_PER_INSTRUCTION: 62 (16 MHz) on the generic and UNO builds, 14 (72 MHz) on the Teensy build
+
+cd "$( dirname "$0" )"
+PROGRAM=${1:-stress400.cpp}
+[ $# -gt 0 ] && shift
+SRC="../../src/*.cpp ../../src/hw/*.cpp host400.cpp"
+OUT=${TMPDIR:-/tmp}/host400
+mkdir -p $OUT
+for CFG in std uno teensy; do
+  case $CFG in
+    std) FLAGS="-DNS_PER_INSTRUCTION=62 ../../src/timer/TwoTimer.cpp";;
+    uno) FLAGS="-D__AVR_ATmega328P__ -DNS_PER_INSTRUCTION=62 ../../src/timer/TwoTimer.cpp";;
+    teensy) FLAGS="-D__MK20DX256__ -DNS_PER_INSTRUCTION=14";;
+  esac
+  g++ -std=gnu++11 -O1 -Wall -Wno-unused-variable -I. -I../../src $FLAGS $SRC $PROGRAM -o $OUT/$CFG || exit 1
+done
+for CFG in std uno teensy; do
+  ( $OUT/$CFG "$@" > $OUT/$CFG.txt 2>&1; echo $? > $OUT/$CFG.status ) &
+done
+wait
+STATUS=0
+for CFG in std uno teensy; do
+  echo "# $CFG"
+  cat $OUT/$CFG.txt
+  [ "$( cat $OUT/$CFG.status )" = 0 ] || STATUS=1
+done
+exit $STATUS
@@ -0,0 +1,296 @@
+// Pulse400 interleaving stress test for the host simulator (see host400.h and run.sh)
+//
+// sweep: for every timer interrupt of a frame and every instruction boundary of a single pulse() call and of a
+//   bank update (pulse( ..., true ) on every channel, then update()) the update is started so that the interrupt
+//   lands on exactly that boundary. Every frame output afterwards is checked.
+// detach: the same for detach() of the last channel, its pin must not be left HIGH.
+// failsafe: a channel rewritten with its current value every frame keeps the failsafe queue off, it takes over
+//   when the writes stop.
+// storm: random single and bank updates at increasing rates on the simulated CPU, the timer interrupts preempt
+//   them wherever they become due. Every frame is checked, the last line is the highest update rate the
+//   simulated CPU sustained (90% of the requested rate or better) with every frame correct.
+//
+// A frame is correct when every channel rises at the frame start and falls once, after a pulse width that
+// was valid during the frame: the value set before the previous frame started or one written since. Frames
+// that start a full period after an update ended must show it (STORM_LATE periods in the storm), a bank update
+// shows up in full or not at all.
+// The queues must also pass verify() after every run.
+//
+// Instructions are x86 instructions timed at NS_PER_INSTRUCTION, not the target's: the rates are a model of
+// the interleaving, not a measurement of a board.
+
+#include <Pulse400.h>
+#include <new>
+#include <vector>
+#include "host400.h"
+
+#ifndef NS_PER_INSTRUCTION
+  #define NS_PER_INSTRUCTION 62 // About one instruction per cycle at 16 MHz
+#endif
+
+#define CHANNELS 8
+#define FREQUENCY 400
+#define PERIOD ( 1000000UL / FREQUENCY )
+#define TOLERANCE 2 // The microsecond edge log, plus the interrupt delays and merged edge groups
+#define STORM_TIME 200000UL // Simulated microseconds per rate
+#define STORM_LATE 3 // Periods an update may take to show when the next one is still being built at the point of no return
+
+alignas( Pulse400 ) static uint8_t storage[sizeof( Pulse400 )];
+static Pulse400 * pulse400;
+static int8_t pin[CHANNELS] = { 2, 3, 4, 5, 6, 7, 8, 9 };
+static int8_t id[CHANNELS];
+
+struct write_t { // A pulse width written by an update, in effect from start (may be) to end (must be)
+  uint32_t start;
+  uint32_t end;
+  uint16_t pw;
+  uint32_t op;
+};
+
+static std::vector<write_t> history[CHANNELS];
+
+struct op_t {
+  bool detach; // detach() ch[0]
+  uint8_t cnt; // 0: single pulse() on ch[0]
+  uint8_t ch[CHANNELS];
+  uint16_t pw[CHANNELS];
+};
+
+static op_t op;
+static uint32_t op_no;
+static uint32_t failed; // Errors of all tests, the exit code
+static uint8_t checked = CHANNELS; // Channels check_frames() looks at
+
+static void op_run( void ) {
+  if ( op.detach ) {
+    pulse400->detach( id[op.ch[0]] );
+  } else if ( op.cnt == 0 ) {
+    pulse400->pulse( id[op.ch[0]], op.pw[0] );
+  } else {
+    for ( uint8_t i = 0; i < op.cnt; i++ ) pulse400->pulse( id[op.ch[i]], op.pw[i], true );
+    pulse400->update();
+  }
+}
+
+static uint32_t apply( void ) { // Runs op on the simulated CPU and logs the writes
+  uint32_t start = host_now() / 1000;
+  uint32_t n = host_step( op_run, NS_PER_INSTRUCTION );
+  uint32_t end = host_now() / 1000;
+  op_no++;
+  for ( uint8_t i = 0; i < ( op.cnt ? op.cnt : 1 ); i++ ) {
+    history[op.ch[i]].push_back( { start, end, op.pw[i], op_no } );
+  }
+  return n;
+}
+
+static void setup( const uint16_t * pw ) {
+  host_reset();
+  pulse400 = new ( storage ) Pulse400();
+  op_no = 0;
+  for ( uint8_t ch = 0; ch < CHANNELS; ch++ ) {
+    id[ch] = pulse400->attach( pin[ch] );
+    history[ch].clear();
+  }
+  pulse400->frequency( FREQUENCY );
+  for ( uint8_t ch = 0; ch < CHANNELS; ch++ ) {
+    pulse400->pulse( id[ch], pw[ch], true );
+    history[ch].push_back( { 0, 0, pw[ch], 0 } );
+  }
+  pulse400->update();
+}
+
+// Checks every complete frame in the edge log, returns the number of frames and adds the bad ones to errors
+
+static uint32_t check_frames( uint32_t& errors, bool atomic, uint8_t periods ) {
+  host_edge_t * e = host_edges();
+  uint32_t n = host_edge_count();
+  uint32_t frames = 0;
+  std::vector<uint32_t> rise;
+  for ( uint32_t i = 0; i < n; i++ ) {
+    if ( e[i].pin == pin[0] && e[i].level ) rise.push_back( i );
+  }
+  for ( size_t f = 0; f + 1 < rise.size(); f++ ) {
+    uint32_t t = e[rise[f]].t;
+    uint32_t next = e[rise[f + 1]].t;
+    bool ok = true;
+    uint32_t seen_op[2] = { 0, 0 }; // Bank updates: ops whose value a channel showed, and didn't
+    for ( uint8_t ch = 0; ch < checked; ch++ ) {
+      int32_t up = -1, down = -1;
+      uint32_t lag = 0;
+      for ( uint32_t i = rise[f] > 2 * CHANNELS ? rise[f] - 2 * CHANNELS : 0; i < n && e[i].t < next; i++ ) {
+        if ( e[i].pin != pin[ch] || e[i].t < t ) continue;
+        if ( e[i].level && up < 0 ) {
+          up = e[i].t;
+          lag = e[i].lag;
+        } else if ( !e[i].level && up >= 0 && down < 0 ) {
+          down = e[i].t;
+          lag = e[i].lag - lag;
+        }
+      }
+      if ( up != (int32_t) t || down < 0 ) {
+        if ( errors == 0 ) fprintf( stderr, "frame %u: channel %u rise %d fall %d\n", t, ch, up, down );
+        ok = false;
+        continue;
+      }
+      uint32_t width = down - up;
+      int late = TOLERANCE + ( lag + 999 ) / 1000; // Interrupts held off by cli() delay the edges after them
+      int early = TOLERANCE - PULSE400_MINIMUM_INTERVAL; // A group of n edges chained at most this far apart falls with its first
+      for ( uint32_t i = rise[f]; i < n && e[i].t <= (uint32_t) down; i++ ) {
+        if ( e[i].t == (uint32_t) down && !e[i].level ) early += PULSE400_MINIMUM_INTERVAL;
+      }
+      const write_t * base = &history[ch][0]; // Last write that ended before the previous frame started
+      bool match = false;
+      for ( auto& w : history[ch] ) {
+        if ( w.end + periods * PERIOD < t ) base = &w;
+      }
+      for ( auto& w : history[ch] ) {
+        if ( &w != base && ( w.end + periods * PERIOD < t || w.start > (uint32_t) down ) ) continue;
+        if ( (int) width - (int) w.pw <= late && (int) w.pw - (int) width <= early ) {
+          match = true;
+          if ( atomic && w.op ) seen_op[1] |= 1; // The bank update is visible
+          if ( atomic && !w.op ) seen_op[0] |= 1; // The initial values are visible
+        }
+      }
+      if ( !match ) {
+        if ( errors == 0 ) fprintf( stderr, "frame %u: channel %u width %u, expected %u\n", t, ch, width, base->pw );
+        ok = false;
+      }
+    }
+    if ( atomic && seen_op[0] && seen_op[1] ) {
+      if ( errors == 0 ) fprintf( stderr, "frame %u: bank update partially applied\n", t );
+      ok = false;
+    }
+    if ( !pulse400->verify() ) ok = false;
+    if ( !ok ) errors++;
+    frames++;
+  }
+  return frames;
+}
+
+// Runs op once from a fresh generator for every (interrupt, boundary) pair of the frame after the settling time
+
+static void sweep( const char * name, const uint16_t * initial, uint32_t stride ) {
+  setup( initial );
+  host_run( 3 * PERIOD );
+  uint64_t frame = host_now();
+  std::vector<uint64_t> due;
+  while ( host_timer_due() < frame + PERIOD * 1000ULL ) { // Every interrupt of one frame
+    due.push_back( host_timer_due() );
+    host_run_until( host_timer_due() );
+  }
+  host_run_until( frame );
+  uint32_t boundaries = apply() + 1;
+  uint32_t runs = 0, frames = 0, errors = 0;
+  for ( size_t d = 0; d < due.size(); d++ ) {
+    for ( uint32_t k = 0; k < boundaries; k += stride ) {
+      setup( initial );
+      host_run_until( due[d] - (uint64_t) k * NS_PER_INSTRUCTION );
+      host_edges_clear();
+      uint32_t start = host_now() / 1000;
+      host_step( op_run, NS_PER_INSTRUCTION, due[d] + NS_PER_INSTRUCTION ); // Counted until the interrupt has run
+      op_no++;
+      for ( uint8_t i = 0; i < ( op.cnt ? op.cnt : 1 ); i++ ) {
+        history[op.ch[i]].push_back( { start, (uint32_t)( host_now() / 1000 ), op.pw[i], op_no } );
+      }
+      host_run( 4 * PERIOD );
+      frames += check_frames( errors, op.cnt > 1, 1 );
+      if ( !pulse400->verify() ) errors++;
+      if ( op.detach && host_pin( pin[op.ch[0]] ) ) { // Nothing pulls it down anymore
+        if ( errors == 0 ) fprintf( stderr, "%s: pin %d stuck HIGH\n", name, pin[op.ch[0]] );
+        errors++;
+      }
+      runs++;
+    }
+  }
+  printf( "%s,%u,%u,%u,%u,%u\n", name, (unsigned) due.size(), boundaries, runs, frames, errors );
+  failed += errors;
+}
+
+static void random_op( void ) {
+  if ( random( 4 ) ) {
+    op.cnt = 0;
+    op.ch[0] = random( CHANNELS );
+    op.pw[0] = random( 1000, 2001 );
+  } else {
+    op.cnt = random( 1, CHANNELS + 1 );
+    for ( uint8_t i = 0; i < op.cnt; i++ ) {
+      op.ch[i] = ( i + random( CHANNELS ) ) % CHANNELS;
+      op.pw[i] = random( 1000, 2001 );
+    }
+  }
+}
+
+int main( int argc, char ** argv ) {
+  uint32_t stride = argc > 1 ? atoi( argv[1] ) : 1;
+  uint16_t spread[CHANNELS], reversed[CHANNELS];
+  for ( uint8_t ch = 0; ch < CHANNELS; ch++ ) {
+    spread[ch] = 1100 + ch * 100;
+    reversed[ch] = 1950 - ch * 100;
+  }
+
+  printf( "op,interrupts,boundaries,runs,frames,errors\n" );
+  op.cnt = 0; // One channel moves from the middle of the queue to its end
+  op.ch[0] = 3;
+  op.pw[0] = 1950;
+  sweep( "pulse", spread, stride );
+  op.cnt = CHANNELS; // Every channel changes and the queue order reverses
+  for ( uint8_t ch = 0; ch < CHANNELS; ch++ ) {
+    op.ch[ch] = ch;
+    op.pw[ch] = reversed[ch];
+  }
+  sweep( "bank", spread, stride );
+  op.detach = true; // The last channel, the only one on its port on Teensy 3.2 (pin 9: PTC3)
+  op.cnt = 0;
+  op.ch[0] = CHANNELS - 1;
+  checked = CHANNELS - 1;
+  sweep( "detach", spread, stride );
+  op.detach = false;
+  checked = CHANNELS;
+
+  op.cnt = 0; // Steady writes of an unchanged value must keep the failsafe off, stopping them must trip it
+  op.ch[0] = 0;
+  op.pw[0] = spread[0];
+  setup( spread );
+  pulse400->failsafe( 2 );
+  uint32_t errors = 0, frames = 0;
+  for ( ; frames < 20; frames++ ) {
+    host_run( PERIOD );
+    apply();
+    if ( pulse400->failsafe() ) errors++;
+  }
+  host_run( 4 * PERIOD );
+  if ( !pulse400->failsafe() ) errors++;
+  printf( "failsafe,0,0,1,%u,%u\n", frames, errors );
+  failed += errors;
+
+  uint32_t rate[] = { 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000 };
+  uint32_t best = 0;
+  printf( "rate,achieved,frames,errors,latency_us\n" );
+  srand( 400 );
+  for ( auto r : rate ) {
+    setup( spread );
+    host_run( 2 * PERIOD );
+    host_edges_clear();
+    uint64_t start = host_now();
+    uint64_t next = start;
+    uint32_t updates = 0;
+    while ( host_now() - start < STORM_TIME * 1000ULL ) {
+      host_run_until( next );
+      random_op();
+      apply();
+      updates++;
+      next += 1000000000ULL / r;
+      if ( next < host_now() ) next = host_now(); // Saturated: start the next one right away
+    }
+    host_run( 2 * PERIOD );
+    errors = 0;
+    frames = check_frames( errors, false, STORM_LATE );
+    uint32_t achieved = (uint64_t) updates * 1000000 / STORM_TIME;
+    printf( "%u,%u,%u,%u,%.1f\n", r, achieved, frames, errors, host_latency() / 1000.0 );
+    if ( errors == 0 && achieved >= r * 9 / 10 ) best = r;
+    failed += errors;
+    if ( errors || achieved < r * 9 / 10 ) break;
+  }
+  printf( "max_sustained_rate,%u\n", best );
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""
+Decoder for the Telemetry400 binary record stream
+
+Reads records from a file (or stdin, or a serial port with pyserial installed) and prints them as CSV:
+
+  frame,time,rate,dropped,pw0..pwN,rc0..rcN
+
+Usage:
+
+  telemetry400.py log.bin
+  telemetry400.py /dev/ttyACM0 115200
+  cat log.bin | telemetry400.py
+
+Records that fail the checksum are skipped, the decoder resynchronizes on the next sync byte.
+"""
+
+import struct
+import sys
+
+SYNC = 0xA5
+HEADER = struct.Struct( '<BBBBHIHH' ) # sync, size, outputs, inputs, frame, time, rate, dropped
+
+
+def records( read ):
+    buf = bytearray()
+    header = False
+    while True:
+        chunk = read( 256 )
+        if not chunk:
+            return
+        buf += chunk
+        while True:
+            start = buf.find( SYNC )
+            if start < 0:
+                buf.clear()
+                break
+            del buf[:start]
+            if len( buf ) < HEADER.size:
+                break
+            sync, size, outputs, inputs, frame, time, rate, dropped = HEADER.unpack_from( buf )
+            if size != HEADER.size + 2 * ( outputs + inputs ) + 1: # Not a record header
+                del buf[:1]
+                continue
+            if len( buf ) < size:
+                break
+            if sum( buf[:size - 1] ) & 0xFF != buf[size - 1]: # Corrupt or false sync
+                del buf[:1]
+                continue
+            pw = struct.unpack_from( '<%dH' % outputs, buf, HEADER.size )
+            rc = struct.unpack_from( '<%dh' % inputs, buf, HEADER.size + 2 * outputs )
+            if not header:
+                print( ','.join( [ 'frame', 'time', 'rate', 'dropped' ] + [ 'pw%d' % i for i in range( outputs ) ] + [ 'rc%d' % i for i in range( inputs ) ] ) )
+                header = True
+            yield [ frame, time, rate, dropped ] + list( pw ) + list( rc )
+            del buf[:size]
+
+
+def main():
+    if len( sys.argv ) > 2: # Serial port
+        import serial
+        port = serial.Serial( sys.argv[1], int( sys.argv[2] ) )
+        read = lambda n: port.read( 1 ) + port.read( port.in_waiting )
+    elif len( sys.argv ) > 1:
+        read = open( sys.argv[1], 'rb' ).read
+    else:
+        read = sys.stdin.buffer.read
+    for record in records( read ):
+        print( ','.join( str( v ) for v in record ) )
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
@@ -5,14 +5,9 @@ Multi400::Multi400( Pulse400& pulse400 ) {
 }
 
 Multi400& Multi400::begin( int8_t pin0, int8_t pin1, int8_t pin2, int8_t pin3, int8_t pin4, int8_t pin5, int8_t pin6, int8_t pin7 ) {
-  pulse400->attach( pin0, 0 );
-  pulse400->attach( pin1, 1 );
-  pulse400->attach( pin2, 2 );
-  pulse400->attach( pin3, 3 );
-  pulse400->attach( pin4, 4 );
-  pulse400->attach( pin5, 5 );
-  pulse400->attach( pin6, 6 );
-  pulse400->attach( pin7, 7 );
+  const int8_t pins[8] = { pin0, pin1, pin2, pin3, pin4, pin5, pin6, pin7 };
+  int8_t ids[8];
+  pulse400->attachAll( pins, 8, ids, 0 ); // ESC n on channel n, one queue build
   return *this;
 }
 
@@ -32,7 +27,12 @@ Multi400& Multi400::set( int16_t v0, int16_t v1, int16_t v2, int16_t v3, int16_t
 
 Multi400& Multi400::speed( uint8_t no, int16_t v, bool no_update ) {
   if ( v > -1 && !disabled ) {
-    pulse400->pulse( no, map( constrain( v, 0, 1000 ), 0, 1000, min, max ), no_update );
+    uint16_t pw = map( constrain( v, 0, 1000 ), 0, 1000, min, max );
+    if ( ramp_rate ) {
+      pulse400->move( no, pw, (uint32_t) ramp_rate * ( max - min ) / 1000, (uint32_t) ramp_accel * ( max - min ) / 1000 );
+    } else {
+      pulse400->pulse( no, pw, no_update );
+    }
   }
   return *this;
 }
@@ -42,8 +42,11 @@ int16_t Multi400::speed( uint8_t no ) {
   return v == -1 ? -1 : map( v, min, max, 0, 1000 );
 } 
 
-Multi400& Multi400::off( void ) {
+Multi400& Multi400::off( void ) { // Never ramped
+  uint16_t rate = ramp_rate;
+  ramp_rate = 0;
   set( 0, 0, 0, 0, 0, 0, 0, 0 );
+  ramp_rate = rate;
   return *this;
 }
 
@@ -63,6 +66,18 @@ Multi400& Multi400::sync() {
   return *this;
 }
 
+Multi400& Multi400::oneshot( bool v /* = true */ ) {
+  pulse400->oneshot( v );  
+  return *this;
+}
+
+// All motors off (minimum pulse) if set() isn't called for frames frames
+
+Multi400& Multi400::failsafe( uint8_t frames ) {
+  pulse400->failsafe( frames, min );
+  return *this;
+}
+
 Multi400& Multi400::frequency( uint16_t f ) {
   pulse400->frequency( f );
   return *this;
@@ -71,13 +86,122 @@ Multi400& Multi400::frequency( uint16_t f ) {
 Multi400& Multi400::outputRange( uint16_t min, uint16_t max, int16_t minPulse /* -1 */) {
   this->min = min;
   this->max = max;
+  mix_scale = ( (int32_t) ( max - min ) << 14 ) / 1000;
   off();
   pulse400->minPulse( minPulse > -1 ? minPulse : min );
   return *this;
 }
 
+// speed() and set() ramp to the new value at rate units (of 0..1000) per second, accelerating at accel units/s²
+// The generator runs the ramps once per frame, mix() and off() are never ramped. rate = 0: off
+
+Multi400& Multi400::ramp( uint16_t rate, uint16_t accel /* = 0 */ ) {
+  ramp_rate = rate;
+  ramp_accel = accel;
+  return *this;
+}
+
 Multi400& Multi400::end( void ) {
   for ( int i = 0; i < MULTI400_NO_OF_CHANNELS; i++ ) 
     pulse400->detach( i );
   return *this;
 }
+
+// Fixed point mixer, no floats and a single division (only when desaturating)
+// Cores with __ARM_FEATURE_DSP (Cortex-M4: Teensy 3.0-3.6, not the LC) use the DSP dual 16 bit instructions
+
+#define MULTI400_PAIRS ( ( MULTI400_NO_OF_CHANNELS + 1 ) / 2 ) // Outputs are processed in pairs
+
+static inline uint32_t multi400_pack( int16_t lo, int16_t hi ) {
+  return (uint16_t) lo | (uint32_t) hi << 16;
+}
+
+// acc + a.lo * b.lo + a.hi * b.hi
+
+static inline int32_t multi400_smlad( uint32_t a, uint32_t b, int32_t acc ) {
+#if defined( __ARM_FEATURE_DSP )
+  int32_t r;
+  asm( "smlad %0, %1, %2, %3" : "=r" ( r ) : "r" ( a ), "r" ( b ), "r" ( acc ) );
+  return r;
+#else
+  return acc + (int32_t) (int16_t) a * (int16_t) b + (int32_t) (int16_t) ( a >> 16 ) * (int16_t) ( b >> 16 );
+#endif
+}
+
+// Two 16 bit additions at once
+
+static inline uint32_t multi400_sadd16( uint32_t a, uint32_t b ) {
+#if defined( __ARM_FEATURE_DSP )
+  uint32_t r;
+  asm( "sadd16 %0, %1, %2" : "=r" ( r ) : "r" ( a ), "r" ( b ) );
+  return r;
+#else
+  return multi400_pack( (int16_t) a + (int16_t) b, (int16_t) ( a >> 16 ) + (int16_t) ( b >> 16 ) );
+#endif
+}
+
+// Set the mixing matrix (one row per motor, Q14: MULTI400_Q14 = 1.0) and an optional linearisation curve
+// The arrays are not copied, they must stay valid
+
+Multi400& Multi400::mixer( const int16_t matrix[][4], uint8_t motors, const uint16_t * curve /* = NULL */ ) {
+  mix_matrix = matrix;
+  mix_motors = motors < MULTI400_NO_OF_CHANNELS ? motors : MULTI400_NO_OF_CHANNELS;
+  mix_curve = curve;
+  return *this;
+}
+
+// throttle: 0..1000, roll/pitch/yaw: -1000..1000
+// If the outputs don't fit in 0..1000 only the attitude part is scaled down, then everything is shifted into range
+// With throttle coefficients that differ per motor that may still not fit: the outputs are clamped to 0..1000
+
+Multi400& Multi400::mix( int16_t throttle, int16_t roll, int16_t pitch, int16_t yaw ) {
+  if ( !mix_matrix || disabled ) return *this;
+  union { int16_t v[MULTI400_PAIRS * 2]; uint32_t pair[MULTI400_PAIRS]; } base, att;
+  throttle = constrain( throttle, 0, 1000 );
+  uint32_t rp = multi400_pack( roll, pitch );
+  int16_t lo = 32767, hi = -32768;
+  for ( uint8_t m = 0; m < MULTI400_PAIRS * 2; m++ ) {
+    if ( m < mix_motors ) {
+      const int16_t * c = mix_matrix[m];
+      base.v[m] = ( (int32_t) throttle * c[0] ) >> 14;
+      att.v[m] = multi400_smlad( rp, multi400_pack( c[1], c[2] ), (int32_t) yaw * c[3] ) >> 14;
+      int16_t out = base.v[m] + att.v[m];
+      if ( out < lo ) lo = out;
+      if ( out > hi ) hi = out;
+    } else {
+      base.v[m] = att.v[m] = 0;
+    }
+  }
+  if ( hi - lo > 1000 ) { // Desaturate: keep the attitude ratios, give up some authority
+    int32_t f = ( 1000L << 14 ) / ( hi - lo );
+    lo = 32767;
+    hi = -32768;
+    for ( uint8_t m = 0; m < mix_motors; m++ ) {
+      att.v[m] = ( att.v[m] * f ) >> 14;
+      int16_t out = base.v[m] + att.v[m];
+      if ( out < lo ) lo = out;
+      if ( out > hi ) hi = out;
+    }
+  }
+  int16_t shift = hi > 1000 ? 1000 - hi : ( lo < 0 ? -lo : 0 );
+  uint32_t shift2 = multi400_pack( shift, shift );
+  for ( uint8_t p = 0; p < MULTI400_PAIRS; p++ ) {
+    base.pair[p] = multi400_sadd16( multi400_sadd16( base.pair[p], att.pair[p] ), shift2 );
+  }
+  for ( uint8_t m = 0; m < mix_motors; m++ ) {
+    int16_t v = constrain( base.v[m], 0, 1000 ); // Rounding, or a throttle column the scaling can't fit
+    if ( mix_curve ) { // Piecewise linear, 16 segments of 62.5
+      uint16_t x = ( (uint32_t) v * 4195 ) >> 10; // v * 16 * 256 / 1000
+      uint8_t i = x >> 8;
+      if ( i >= MULTI400_CURVE_POINTS - 1 ) {
+        v = mix_curve[MULTI400_CURVE_POINTS - 1];
+      } else {
+        v = mix_curve[i] + ( ( (int32_t) ( mix_curve[i + 1] - mix_curve[i] ) * ( x & 0xFF ) ) >> 8 );
+      }
+    }
+    pulse400->pulse( m, min + ( ( v * mix_scale ) >> 14 ), true );
+  }
+  pulse400->update();
+  if ( pulse_sync ) pulse400->sync();  
+  return *this;
+}
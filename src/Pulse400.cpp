@@ -9,35 +9,93 @@ Pulse400::Pulse400( void ) {
     channel[ch].pin = PULSE400_UNUSED;
     channel[ch].pw = PULSE400_DEFAULT_PULSE - PULSE400_MIN_PULSE;
     channel[ch].pw = PULSE400_DEFAULT_PULSE - PULSE400_MIN_PULSE;
+    channel[ch].div = 1;
   }  
+  for ( int e = 0; e < PULSE400_MAX_EVENTS; e++ ) {
+    events[e].div = 0;
+  }
   qctl.active = 0;  
   qctl.change = 0;  
 }
 
 int8_t Pulse400::attach( int8_t pin, int8_t force_id /* = -1 */ ) {
-  if ( pin != PULSE400_UNUSED ) {
-    int id_channel = force_id > -1 ? force_id : channel_find( pin ); 
-    if ( id_channel != -1 ) {
-      pinMode( pin, OUTPUT );
-      digitalWrite( pin, LOW );
-      int count = channel_count();
-      channel[id_channel].pin = pin;
-      channel[id_channel].pw = PULSE400_DEFAULT_PULSE - PULSE400_MIN_PULSE;
-      update();
-      if ( count == 0 ) { // Start the timer as soon as the first channel is created
-        timer_start(); 
-      }
+  int8_t id_channel;
+  attachAll( &pin, 1, &id_channel, force_id );
+  return id_channel;
+}
+
+// Attaches n pins (PULSE400_UNUSED entries are skipped) with a single queue rebuild and stores their channel ids 
+// (-1: failed) in ids. first_id > -1 forces pins[i] to channel first_id + i. Returns the number of pins attached
+// On the UNO the pins are switched to OUTPUT/LOW with one write per port. The timer is started after the queue 
+// is built, so all channels get their first pulse in the same frame. Shift register outputs: pins that aren't in the
+// chain are skipped, the first attach starts the SPI bus and clears the chain
+
+uint8_t Pulse400::attachAll( const int8_t pins[], uint8_t n, int8_t ids[], int8_t first_id /* = -1 */ ) {
+  int count = channel_count();
+  uint8_t attached = 0;
+#if defined( __AVR_ATmega328P__ ) && !defined( PULSE400_SHIFT_595 )
+  uint8_t mask[4] = { 0 }; // By port: -, B, C, D
+#endif
+  for ( uint8_t i = 0; i < n; i++ ) {
+    ids[i] = -1;
+    if ( pins[i] == PULSE400_UNUSED ) continue;
+    int id_channel = first_id > -1 ? first_id + i : channel_find( pins[i] ); 
+    if ( id_channel == -1 || id_channel >= PULSE400_MAX_CHANNELS ) continue;
+#if defined( PULSE400_SHIFT_595 )
+    if ( !pulse400_valid( pins[i] ) ) continue;
+#else
+#if defined( __AVR_ATmega328P__ )
+    if ( pulse400_valid( pins[i] ) ) {
+      mask[pulse400_port( pins[i] )] |= 1 << pulse400_bit( pins[i] );
+    } else 
+#endif
+    {
+      pinMode( pins[i], OUTPUT );
+      digitalWrite( pins[i], LOW );
     }
-    return id_channel;
+#endif
+    channel[id_channel].pin = pins[i];
+    channel[id_channel].pw = PULSE400_DEFAULT_PULSE - PULSE400_MIN_PULSE;
+    channel[id_channel].div = 1;
+    ids[i] = id_channel;
+    attached++;
   }
-  return -1;
+  if ( attached ) {
+#if defined( PULSE400_SHIFT_595 )
+    if ( count == 0 ) shift_begin();
+#elif defined( __AVR_ATmega328P__ )
+    PORTB &= ~mask[1];
+    PORTC &= ~mask[2];
+    PORTD &= ~mask[3];
+    DDRB |= mask[1];
+    DDRC |= mask[2];
+    DDRD |= mask[3];
+#endif
+    dirty[0] = dirty[1] = PULSE400_DIRTY_ALL;
+    update();
+    if ( count == 0 && mode != PULSE400_MODE_BLOCKING ) { // Start the timer once the first channels are in the queue
+      timer_start(); 
+    }
+  }
+  return attached;
 }
 
 Pulse400& Pulse400::detach( int8_t id_channel ) {
   if ( id_channel != PULSE400_UNUSED ) {
+    cli();
+    int8_t pin = channel[id_channel].pin;
+#if defined( PULSE400_OPTIMIZE_STANDARD )
+    if ( pin != PULSE400_UNUSED ) digitalWrite( pin, LOW ); // The ISR writes through channel[].pin: it can't pull it down anymore
+#endif
     channel[id_channel].pin = PULSE400_UNUSED;
+#if defined( PULSE400_MOTION )
+    motion_active &= ~( 1UL << id_channel );
+#endif
+    dirty[0] = dirty[1] = PULSE400_DIRTY_ALL;
+    sei();
     if ( channel_count() == 0 ) {
       timer_stop();
+      if ( pin != PULSE400_UNUSED ) digitalWrite( pin, LOW ); // Possibly stopped halfway through its pulse
     } else {
       update();
     }
@@ -48,35 +106,23 @@ Pulse400& Pulse400::detach( int8_t id_channel ) {
 Pulse400& Pulse400::pulse( int8_t id_channel, uint16_t pw, bool no_update ) {
   if ( id_channel != PULSE400_UNUSED && channel[id_channel].pin != PULSE400_UNUSED ) {
     pw = constrain( pw, 1, cycle_width + PULSE400_MIN_PULSE - 1 ) - PULSE400_MIN_PULSE;
-    if ( channel[id_channel].pw != pw ) {
+    cli(); // The motion profiles write the same fields from the deferred interrupt
+#if defined( PULSE400_MOTION )
+    motion_active &= ~( 1UL << id_channel ); // A direct write ends a running move
+#endif
+    bool changed = channel[id_channel].pw != pw;
+    if ( changed ) {
       channel[id_channel].pw = pw;
-      if ( no_update ) {
-        update_cnt++;
-      } else {
-        if ( update_cnt ) { // Multiple updates pending
-          qctl.change = false;
-          update(); // Rebuild the whole queue         
-        } else { // Single update pending
-#if defined( __TEENSY_3X__ )  && defined( PULSE400_OPTIMIZE_TEENSY_3X )
-          qctl.change = false;
-          update(); // Rebuild the whole queue including Teensy bitmaps        
-#else        
-          cli(); // Disable interrupts while aborting a possibly pending queue switch
-          if ( qctl.change ) { // Queue switch in progress, abort while ints are off        
-            qctl.change = false;
-            sei(); // Re-enable interrupts
-            // And update the non-active queue using itself as a source
-            update_queue_entry( queue[qctl.active ^ 1], queue[qctl.active ^ 1], id_channel, pw );  
-          } else {
-            sei(); // Re-enable interrupts
-            // Update the non-active queue using the active queue as a source
-            update_queue_entry( queue[qctl.active], queue[qctl.active ^ 1], id_channel, pw );        
-          }
-#endif          
-          qctl.change = true; // Set the qctl.change flag (again)
-        }
-        update_cnt = 0;
-      }
+      dirty[0] |= 1UL << id_channel;
+      dirty[1] |= 1UL << id_channel;
+    }
+    if ( !no_update ) stale_cnt = 0; // Feeds the failsafe watchdog even when the value didn't change
+    sei();
+    if ( changed && !no_update ) {
+#ifdef PULSE400_LATE_UPDATE
+      if ( !lazy_mode ) late_update( id_channel, pw ); // Also apply to the running frame if still possible
+#endif
+      update();
     }
   }
   return *this;
@@ -86,11 +132,73 @@ int16_t Pulse400::pulse( int8_t id_channel ) {
   return id_channel != PULSE400_UNUSED ? channel[id_channel].pw + PULSE400_MIN_PULSE : -1;
 }
 
+// Moves the channel to pw at up to slew microseconds per second, speeding up and braking at accel us/s² (0: no ramp)
+// The generator advances the move once per frame after the last falling edge, pulse() on the channel ends it
+// Rates are per frequency() frame: faster in adaptive mode, slower when one-shot frames are sent less often
+
+Pulse400& Pulse400::move( int8_t id_channel, uint16_t pw, uint16_t slew, uint16_t accel /* = 0 */ ) {
+#if defined( PULSE400_MOTION )
+  if ( slew == 0 ) return pulse( id_channel, pw );
+  if ( id_channel != PULSE400_UNUSED && channel[id_channel].pin != PULSE400_UNUSED ) {
+    hook_vector( true );
+    uint32_t f = frequency();
+    uint32_t s = ( (uint32_t) slew << 8 ) / f;
+    uint32_t a = ( (uint32_t) accel << 8 ) / f / f;
+    motion_struct_t& m = motion[id_channel];
+    cli();
+    if ( !( motion_active & ( 1UL << id_channel ) ) ) { // Already moving: retarget at the current speed
+      m.pos = (int32_t) channel[id_channel].pw << 8;
+      m.speed = 0;
+    }
+    m.target = constrain( pw, 1, cycle_width + PULSE400_MIN_PULSE - 1 ) - PULSE400_MIN_PULSE;
+    m.slew = constrain( s, 1, 32767 );
+    m.accel = accel ? constrain( a, 1, 65535 ) : 0;
+    motion_active |= 1UL << id_channel;
+    sei();
+  }
+  return *this;
+#else
+  return pulse( id_channel, pw );
+#endif
+}
+
+bool Pulse400::moving( int8_t id_channel ) {
+#if defined( PULSE400_MOTION )
+  return id_channel != PULSE400_UNUSED && ( motion_active & ( 1UL << id_channel ) );
+#else
+  return false;
+#endif
+}
+
 Pulse400& Pulse400::frequency( uint16_t f ) {
+#if defined( PULSE400_AVR_NAKED )
+  if ( f < PULSE400_NAKED_MIN_FREQ ) f = PULSE400_NAKED_MIN_FREQ;
+#endif
   cycle_width = ( 1000000 / f ) - PULSE400_MIN_PULSE;
   return *this;
 }
 
+uint16_t Pulse400::frequency( void ) {
+  return 1000000UL / ( cycle_width + PULSE400_MIN_PULSE );
+}
+
+// Output the channel only every div'th frame (rounded up to a power of two, max PULSE400_MAX_DIVIDER)
+// Pulled down at its falling edge in every frame, which is harmless for a pin that didn't go high
+// The rising edge masks belong to the queues: takes effect at the queue switch after the rebuild
+
+Pulse400& Pulse400::divider( int8_t id_channel, uint16_t div ) {
+  if ( id_channel != PULSE400_UNUSED && channel[id_channel].pin != PULSE400_UNUSED ) {
+    uint8_t d = 1;
+    while ( d < div && d < PULSE400_MAX_DIVIDER ) d <<= 1;
+    cli();
+    channel[id_channel].div = d;
+    dirty[0] = dirty[1] = PULSE400_DIRTY_ALL;
+    sei();
+    update();
+  }
+  return *this;
+}
+
 Pulse400& Pulse400::minPulse( int16_t f ) {
   if ( f >= 360 && f < 2500 ) {
     for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
@@ -105,25 +213,159 @@ Pulse400& Pulse400::minPulse( int16_t f ) {
   return *this;
 }
 
-// Update/refresh the entire (ALT) queue and set the qctl.change flag 
+// Bring the ALTernate queue up to date and set the qctl.change flag
+// Only the channels changed since the queue was last built are moved, attach/detach rebuilds it completely
 
 Pulse400& Pulse400::update() {
+  lazy_pending = true;
+  if ( !lazy_mode ) poll(); // Lazy: rebuilt once per frame by poll() or the deferred commit
+  return *this;
+}
+
+// Lazy mode: update() only marks the queues stale, they're rebuilt once per frame by poll() from the main loop or
+// by a deferred interrupt lead microseconds before the point of no return (the lead of the onDeadline() hook if set)
+
+Pulse400& Pulse400::lazy( bool v /* = true */, uint16_t lead /* = PULSE400_COMMIT_LEAD */ ) {
+  hook_vector( true );
+  cli();
+  lazy_mode = v;
+  if ( !hook_deadline ) hook_lead = lead;
+  sei();
+  if ( !v ) poll();
+  return *this;
+}
+
+// Rebuilds the queues if anything changed since the last commit
+// Skipped if a rebuild is already running further down the stack, that one loops until nothing is left
+
+Pulse400& Pulse400::poll( void ) {
+  cli();
+  if ( !lazy_busy ) {
+    lazy_busy = true;
+    while ( ( lazy_pending || motion_pending ) && !commit_deferred ) {
+      bool feed = lazy_pending; // Only updates from the sketch count for the failsafe watchdog
+      lazy_pending = motion_pending = false;
+      sei();
+      commit( feed );
+      cli();
+    }
+    lazy_busy = false;
+  }
+  sei();
+  return *this;
+}
+
+void Pulse400::commit( bool feed ) {
+  cli(); // Abort a possibly pending queue switch while ints are off (qctl is shared with the ISR)
+  if ( qctl.change && switch_missed ) { // Updates in step with the frame would hold the switch back every time
+    commit_deferred = true; // Left dirty: rebuilt after the switch, a frame ahead of the next point of no return
+    lazy_pending |= feed;
+    motion_pending |= !feed;
+    hook_vector( true );
+    sei();
+    return;
+  }
+  switch_held = qctl.change;
   qctl.change = false;
+  if ( event_expired ) { // Drop one-shot events that ran out
+    event_expired = false;
+    dirty[0] = dirty[1] = PULSE400_DIRTY_ALL;
+  }
+  uint8_t alt = qctl.active ^ 1; // Stable: the ISR only switches queues when qctl.change is set
+  uint32_t changed = dirty[alt]; // Channels changed from here on are left for the next commit
+  dirty[alt] = 0;
+  sei();
+  if ( changed & PULSE400_DIRTY_ALL ) {
+    update_queue( queue[alt], position[alt] );
+    init_phases( alt ); // The rising edges for the same channels, switched with the queue
+  } else {
+    uint32_t bit = 1;
+    for ( int ch = 0; changed >= bit; ch++, bit <<= 1 ) {
+      if ( changed & bit ) {
+        update_queue_entry( queue[alt], position[alt], ch, ch < PULSE400_MAX_CHANNELS ? channel[ch].pw : events[ch - PULSE400_MAX_CHANNELS].pw );
+      }
+    }
+  }
+  cli();
+  qctl.change = true;
+  switch_held = false;
+  if ( feed ) stale_cnt = 0; // Feed the failsafe watchdog
+  sei();
+}
+
+// Advances the motion profiles by one frame and rebuilds the queues once for all of them
+// Runs deferred after the last falling edge of a frame, so the next frame carries the new pulse widths
+
+void Pulse400::motion_step( void ) {
+#if defined( PULSE400_MOTION )
+  bool changed = false;
+  uint32_t bit = 1;
+  for ( int ch = 0; motion_active >= bit && ch < PULSE400_MAX_CHANNELS; ch++, bit <<= 1 ) {
+    if ( !( motion_active & bit ) ) continue;
+    motion_struct_t& m = motion[ch];
+    int32_t dist = ( (int32_t) m.target << 8 ) - m.pos;
+    int32_t v = m.speed;
+    int32_t want = dist < 0 ? -(int32_t) m.slew : (int32_t) m.slew;
+    if ( m.accel ) {
+      uint32_t left = dist < 0 ? -dist : dist;
+      uint32_t vabs = v < 0 ? -v : v;
+      if ( ( v < 0 ) == ( dist < 0 ) && vabs * vabs / ( 2UL * m.accel ) + vabs >= left ) { // Braking distance reached
+        want = 0;
+      }
+      want = constrain( want, v - m.accel, v + m.accel );
+    }
+    if ( ( want < 0 ) == ( dist < 0 ) && ( want < 0 ? -want : want ) >= ( dist < 0 ? -dist : dist ) ) { // Arrived
+      m.pos = (int32_t) m.target << 8;
+      m.speed = 0;
+      motion_active &= ~bit;
+    } else {
+      m.pos += want;
+      m.speed = want;
+    }
+    uint16_t pw = ( m.pos + 128 ) >> 8;
+    if ( channel[ch].pw != pw ) {
+      channel[ch].pw = pw;
+      dirty[0] |= bit;
+      dirty[1] |= bit;
+      changed = true;
+    }
+  }
+  if ( changed ) {
+    motion_pending = true;
+    poll();
+  }
+#endif
+}
+
+// Rebuild a queue from scratch
+
+void Pulse400::update_queue( queue_struct_t queue[], uint8_t position[] ) {
   int queue_cnt = 0;
   for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
     if ( channel[ch].pin != PULSE400_UNUSED ) {
-      queue[qctl.active ^ 1][queue_cnt].id = ch;
-      queue[qctl.active ^ 1][queue_cnt].pw = channel[ch].pw;
+      queue[queue_cnt].id = ch;
+      queue[queue_cnt].pw = channel[ch].pw;
+      queue_cnt++;
+    }
+  }
+  for ( int e = 0; e < PULSE400_MAX_EVENTS; e++ ) {
+    if ( events[e].div ) {
+      queue[queue_cnt].id = PULSE400_MAX_CHANNELS + e;
+      queue[queue_cnt].pw = events[e].pw;
       queue_cnt++;
     }
   }
-  queue[qctl.active ^ 1][queue_cnt].id = PULSE400_END_FLAG; // Sentinel value
+  queue[queue_cnt].id = PULSE400_END_FLAG; // Sentinel value
 // TODO benchmark sort algorithms  
-//  sort_on_pulse_width( queue[qctl.active ^ 1], queue_cnt );
-  quicksort_on_pulse_width( queue[qctl.active ^ 1], 0, queue_cnt - 1 );
-  init_optimization( queue[qctl.active ^ 1], queue_cnt );
-  qctl.change = true;
-  return *this;
+//  sort_on_pulse_width( queue, queue_cnt );
+  quicksort_on_pulse_width( queue, 0, queue_cnt - 1 );
+  for ( int i = 0; i < queue_cnt; i++ ) {
+    position[queue[i].id] = i;
+  }
+  init_optimization( queue, queue_cnt );
+  if ( failsafe_frames ) {
+    init_failsafe();
+  }
 }
 
 #if defined( PULSE400_OPTIMIZE_STANDARD )
@@ -131,36 +373,162 @@ Pulse400& Pulse400::update() {
 void Pulse400::init_optimization( queue_struct_t queue[], int8_t queue_cnt ) { 
 }
 
+void Pulse400::init_phases( uint8_t q ) {
+}
+
+#else
+
+// Create queue q's bitmaps for turning pins on in each frame phase, the ISR reads the active queue's set
+// A frame rises with the set of the queue that was active then, frame_deadline() may switch queues after that
+
+void Pulse400::init_phases( uint8_t q ) { // Not in use while it's rebuilt: commit() holds the switch
+  for ( int p = 0; p < PULSE400_MAX_DIVIDER; p++ ) {
+    pulse400_reg_clear( pins_high[q][p] );
+    for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
+      if ( channel[ch].pin != PULSE400_UNUSED && ( p & ( channel[ch].div - 1 ) ) == 0 ) {
+        pulse400_reg_set( pins_high[q][p], channel[ch].pin );
+      }
+    }
+  }
+#if defined( __TEENSY_3X__ ) && !defined( PULSE400_SHIFT_595 )
+  uint8_t ports = 0;
+  for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
+    if ( channel[ch].pin != PULSE400_UNUSED ) ports |= 1 << pulse400_port( channel[ch].pin );
+  }
+  ports_used[q] = ports;
 #endif
+}
 
-// Update a single entry in the queue
+// Create the bitmaps for turning pins on and (compact layout) the per channel bitmaps for turning them off
 
-void Pulse400::update_queue_entry( queue_struct_t src[], queue_struct_t dst[], int8_t id_channel, uint16_t pw ) {
-  int loc = 0; 
-  int cnt = 0;
-  queue_struct_t tmp;
-  channel[id_channel].pw = pw;
-  // Copy the ALT queue from the ACT queue and determine length & item location
-  while ( src[cnt].id != PULSE400_END_FLAG ) {
-    if ( src[cnt].id == id_channel ) loc = cnt;
-    dst[cnt] = src[cnt]; 
-    cnt++;   
-  }
-  dst[cnt] = src[cnt]; // Copy sentinel
-  dst[loc].pw = pw;
-  // Must maintain sort orders
-  while ( loc > 0 && pw < dst[loc - 1].pw ) {
-    tmp = dst[loc]; // Swap with previous entry
-    dst[loc] = dst[loc - 1];
-    dst[loc - 1] = tmp;    
+void Pulse400::init_optimization( queue_struct_t queue[], int8_t queue_cnt ) {
+  for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
+    if ( channel[ch].pin != PULSE400_UNUSED ) {
+#if defined( PULSE400_QUEUE_COMPACT )
+      pin_map[ch].port = pulse400_port( channel[ch].pin );
+      pin_map[ch].mask = 1UL << pulse400_bit( channel[ch].pin );
+#endif
+    }
+  }  
+  init_groups( queue, 0, queue_cnt - 1 );
+}
+
+#endif
+
+#if defined( PULSE400_QUEUE_GROUPS )
+
+// Merge entries with (almost) the same pulse width into groups that are handled by a single interrupt
+// Every entry holds the number of entries from there to the end of its group (and their merged bitmaps)
+// Recomputes entries last..first plus any preceding entries that are (or were) merged with them
+// Timed events are never merged, they're always a group of their own
+
+void Pulse400::init_groups( queue_struct_t queue[], int8_t first, int8_t last ) {
+  int16_t skip_cnt = 1;
+  uint16_t last_pw = 0xFFfF;
+  bool last_event = false;
+#if defined( PULSE400_QUEUE_MASKS )
+  reg_struct_t bits;
+  pulse400_reg_clear( bits );
+#endif
+  if ( queue[last + 1].id != PULSE400_END_FLAG ) { // Continue the (unchanged) group that follows
+    skip_cnt = queue[last + 1].cnt;
+    last_pw = queue[last + 1].pw;
+    last_event = queue[last + 1].id >= PULSE400_MAX_CHANNELS;
+#if defined( PULSE400_QUEUE_MASKS )
+    bits = queue[last + 1].pins_low;
+#endif
+  }
+  for ( int8_t i = last; i >= 0; i-- ) { // Iterate from end to beginning
+    bool event = queue[i].id >= PULSE400_MAX_CHANNELS;
+    if ( !event && !last_event && last_pw - queue[i].pw <= PULSE400_MINIMUM_INTERVAL ) { 
+      skip_cnt++;
+    } else {
+      if ( i < first && queue[i].cnt == 1 ) break; // Was and is a group of its own: preceding entries are unaffected
+      skip_cnt = 1;
+#if defined( PULSE400_QUEUE_MASKS )
+      pulse400_reg_clear( bits );
+#endif
+    }
+    queue[i].cnt = skip_cnt;
+#if defined( PULSE400_QUEUE_MASKS )
+    if ( !event ) pulse400_reg_set( bits, channel[queue[i].id].pin );
+    queue[i].pins_low = bits;
+#endif
+    last_pw = queue[i].pw;
+    last_event = event;
+  } 
+#if defined( PULSE400_AVR_NAKED )
+  init_steps( queue );
+#endif
+}
+
+#if defined( PULSE400_AVR_NAKED )
+
+// Timer ticks from each group head to the next group for the assembly ISR, 0 where the C++ ISR must take over:
+// the last group, groups next to an event, groups too close together to reschedule in time and groups so far
+// apart that the 16 bit difference in the assembly late check would wrap (low frequencies only)
+
+void Pulse400::init_steps( queue_struct_t queue[] ) {
+  uint8_t i = 0;
+  while ( queue[i].id != PULSE400_END_FLAG ) {
+    uint8_t next = i + queue[i].cnt;
+    uint16_t step = 0;
+    if ( queue[i].id < PULSE400_MAX_CHANNELS && queue[next].id < PULSE400_MAX_CHANNELS ) { // Also stops at the sentinel
+      int16_t interval = latency_adjust( queue[next].pw - queue[i].pw, queue[i].cnt, queue[next].cnt );
+      if ( interval >= PULSE400_NAKED_MIN_STEP && interval <= PULSE400_NAKED_MAX_STEP ) step = interval * PULSE400_TICKS_PER_US;
+    }
+    for ( ; i < next; i++ ) queue[i].step = step;
+  }
+}
+
+#endif
+
+#else
+
+void Pulse400::init_groups( queue_struct_t queue[], int8_t first, int8_t last ) { 
+}
+
+#endif
+
+// Move a single entry to its new sorted position, only the entries in between shift one place
+
+void Pulse400::update_queue_entry( queue_struct_t queue[], uint8_t position[], int8_t id_channel, uint16_t pw ) {
+  int8_t loc = position[id_channel];
+  int8_t first = loc;
+  queue_struct_t entry = queue[loc];
+  entry.pw = pw;
+  while ( loc > 0 && pw < queue[loc - 1].pw ) {
+    queue[loc] = queue[loc - 1];
+    position[queue[loc].id] = loc;
     loc--;
   }
-  while ( loc < cnt && pw > dst[loc + 1].pw ) {
-    tmp = dst[loc]; // Swap with next entry
-    dst[loc] = dst[loc + 1];
-    dst[loc + 1] = tmp;    
+  while ( queue[loc + 1].id != PULSE400_END_FLAG && pw > queue[loc + 1].pw ) { // Never past the sentinel
+    queue[loc] = queue[loc + 1];
+    position[queue[loc].id] = loc;
     loc++;
   }
+  queue[loc] = entry;
+  position[id_channel] = loc;
+  init_groups( queue, min( first, loc ), max( first, loc ) ); // Re-merge the groups it left and joined
+}
+
+// Update a single entry in the ACTive queue while a frame is in progress (past the point of no return)
+// Only entries after the one the timer is armed for may move and only to a later falling edge
+
+void Pulse400::late_update( int8_t id_channel, uint16_t pw ) {
+  cli();
+  uint8_t act = qctl.active;
+  if ( qctl.next < PULSE400_JMP_HIGH && !failsafe_active && !( dirty[act] & PULSE400_DIRTY_ALL ) ) { // Position index is valid
+    queue_struct_t * q = queue[act];
+    int8_t armed = frame_armed();
+    if ( position[act][id_channel] > armed && pw > q[armed].pw ) { // Falling edge still in the future
+      update_queue_entry( q, position[act], id_channel, pw ); // Can't pass the armed entry: pw > q[armed].pw
+#if defined( PULSE400_SPLIT_ISR )
+      split_ready = false; // The prepared group may have changed
+#endif
+    }
+  }
+  sei();
 }
 
  void Pulse400::quicksort_on_pulse_width( queue_struct_t list[], int first, int last ) {
@@ -171,9 +539,9 @@ void Pulse400::update_queue_entry( queue_struct_t src[], queue_struct_t dst[], i
     i = first;
     j = last;
     while( i < j){
-      while ( channel[list[i].id].pw <= channel[list[pivot].id].pw && i < last )
+      while ( list[i].pw <= list[pivot].pw && i < last )
         i++;
-      while ( channel[list[j].id].pw > channel[list[pivot].id].pw )
+      while ( list[j].pw > list[pivot].pw )
         j--;
       if ( i < j ) {
         tmp = list[i];
@@ -193,7 +561,7 @@ void Pulse400::sort_on_pulse_width( queue_struct_t list[], uint8_t size ) { // B
   queue_struct_t temp;
   for ( uint8_t i = 0; i < size; i++ ) {
     for ( uint8_t j = size - 1; j > i; j-- ) {
-      if ( channel[list[j].id].pw < channel[list[ j - 1 ].id].pw ) {
+      if ( list[j].pw < list[ j - 1 ].pw ) {
         temp = list[ j - 1 ];
         list[ j - 1 ]=list[ j ];
         list[ j ]=temp;
@@ -202,6 +570,58 @@ void Pulse400::sort_on_pulse_width( queue_struct_t list[], uint8_t size ) { // B
   }
 }
 
+// Frames per second, measured over the last full second (0 if no frames for a while)
+
+uint16_t Pulse400::rate( void ) {
+  cli();
+  uint16_t result = micros() - rate_start > 2000000UL ? 0 : frame_rate;
+  sei();
+  return result;
+}
+
+// Number of frames generated (wraps around)
+
+uint16_t Pulse400::frames( void ) {
+  cli();
+  uint16_t result = frame_cnt;
+  sei();
+  return result;
+}
+
+// Consistency check for testing: the ACTive queue (and the ALTernate queue if a switch is pending) must 
+// be sorted, contain every attached channel and timed event exactly once and be terminated by the sentinel
+// Results are only meaningful while no channels are being attached or detached
+
+bool Pulse400::verify( void ) {
+  cli();
+  uint8_t act = qctl.active;
+  bool result = verify_queue( queue[act], position[act] ) && ( !qctl.change || verify_queue( queue[act ^ 1], position[act ^ 1] ) );
+  sei();
+  return result;
+}
+
+bool Pulse400::verify_queue( queue_struct_t queue[], uint8_t position[] ) {
+  uint32_t seen = 0;
+  int cnt = 0;
+  int channels = 0;
+  while ( queue[cnt].id != PULSE400_END_FLAG ) {
+    if ( cnt == PULSE400_MAX_ENTRIES || queue[cnt].id >= PULSE400_MAX_ENTRIES ) return false;
+    if ( seen & ( 1UL << queue[cnt].id ) ) return false;
+    if ( queue[cnt].id < PULSE400_MAX_CHANNELS ) { // Expired one-shot events stay queued until the next update()
+      if ( channel[queue[cnt].id].pin == PULSE400_UNUSED ) return false;
+      channels++;
+    }
+    if ( cnt > 0 && queue[cnt].pw < queue[cnt - 1].pw ) return false;
+    if ( position[queue[cnt].id] != cnt ) return false;
+#if defined( PULSE400_QUEUE_GROUPS )    
+    if ( queue[cnt].cnt == 0 ) return false; // Merge groups must always advance
+#endif    
+    seen |= 1UL << queue[cnt].id;
+    cnt++;
+  }
+  return channels == channel_count();
+}
+
 int Pulse400::channel_count( void ) {
   int result = 0;
   for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
@@ -212,7 +632,43 @@ int Pulse400::channel_count( void ) {
   return result;
 }
 
-// channel_find( pin ) - returns the first matching channel or the last free one or -1
+// channel_find( pin ) - returns the first matching channel or a free one or -1
+// Optimized boards keep same port pins on neighbouring channels: next to a channel on the same port, otherwise as far
+// from the attached channels as possible (leaves room for the block to grow), otherwise the last free one
+
+#if ( defined( __TEENSY_3X__ ) || defined( __AVR_ATmega328P__ ) ) && !defined( PULSE400_SHIFT_595 )
+
+static bool pulse400_same_port( int8_t a, int8_t b ) {
+  return a != PULSE400_UNUSED && pulse400_valid( a ) && pulse400_valid( b ) && pulse400_port( a ) == pulse400_port( b );
+}
+
+int Pulse400::channel_find( int pin ) { 
+  int port_free = -1;
+  int far_free = -1;
+  int far_dist = -1;
+  for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
+    if ( channel[ch].pin == pin ) {
+      return ch;
+    }
+    if ( channel[ch].pin == PULSE400_UNUSED ) {
+      if ( ( ch > 0 && pulse400_same_port( channel[ch - 1].pin, pin ) ) || 
+        ( ch < PULSE400_MAX_CHANNELS - 1 && pulse400_same_port( channel[ch + 1].pin, pin ) ) ) { 
+        port_free = ch;
+      }
+      int dist = PULSE400_MAX_CHANNELS;
+      for ( int other = 0; other < PULSE400_MAX_CHANNELS; other++ ) {
+        if ( channel[other].pin != PULSE400_UNUSED && abs( other - ch ) < dist ) dist = abs( other - ch );
+      }
+      if ( dist >= far_dist ) {
+        far_free = ch;
+        far_dist = dist;
+      }
+    }
+  }
+  return port_free != -1 ? port_free : far_free;
+}
+
+#else
 
 int Pulse400::channel_find( int pin ) { 
   int result = -1;
@@ -228,18 +684,144 @@ int Pulse400::channel_find( int pin ) {
   return result == -1 ? last_free : result;
 }
 
+#endif
+
+// Pin planning: prints the port of every pin, the port writes per frame of the compiled ISR and a pin set of the same
+// size that replaces the pins the optimized ISRs can't drive and spans as few ports as possible
+
+#if ( defined( __TEENSY_3X__ ) || defined( __AVR_ATmega328P__ ) ) && !defined( PULSE400_SHIFT_595 )
+
+#if defined( __TEENSY_3X__ )
+  #define PULSE400_PLAN_PINS ( sizeof( teensy_pins ) / sizeof( teensy_pins[0] ) )
+  #define PULSE400_PLAN_FIRST 0
+  #define PULSE400_PLAN_PORTS 5 // Ports written by the falling edges (A-E)
+#else
+  #define PULSE400_PLAN_PINS 20
+  #define PULSE400_PLAN_FIRST 2 // Pins 0 & 1 are the serial port
+  #define PULSE400_PLAN_PORTS 3 // Ports written by the ISR (B-D)
+#endif
+
+Pulse400& Pulse400::portPlan( Print& out, const int8_t pins[], uint8_t n ) {
+  uint8_t cnt[5] = { 0 }; // Valid pins per port
+  uint8_t ports = 0;
+  out.println( "pin,port,bit,valid" );
+  for ( uint8_t i = 0; i < n; i++ ) {
+    bool valid = pulse400_valid( pins[i] );
+    out.print( pins[i] ); out.print( ',' );
+    if ( pins[i] >= 0 && pins[i] < (int8_t) PULSE400_PLAN_PINS ) {
+      out.print( (char)( 'A' + pulse400_port( pins[i] ) ) ); out.print( ',' );
+      out.print( pulse400_bit( pins[i] ) ); out.print( ',' );
+    } else {
+      out.print( "-,-," );
+    }
+    out.println( valid ? 1 : 0 );
+    if ( valid && cnt[pulse400_port( pins[i] )]++ == 0 ) ports++;
+  }
+  out.print( "ports," ); out.println( ports );
+#if defined( PULSE400_OPTIMIZE_STANDARD )
+  out.print( "writes_rising," ); out.println( n ); // digitalWrite() per pin
+  out.print( "writes_falling," ); out.println( n );
+#else
+  uint8_t writes = PULSE400_PLAN_PORTS;
+#if defined( __TEENSY_3X__ )
+  out.print( "writes_rising," ); out.println( ports ); // The rising edge skips the ports without channels
+#else
+  out.print( "writes_rising," ); out.println( writes );
+#endif
+  out.print( "writes_falling," ); 
+#if defined( PULSE400_QUEUE_MASKS )
+  out.print( writes ); out.print( '-' ); out.println( writes * n ); // Every port per group: 1..n groups
+#else
+  out.println( n ); // One write per pin
+#endif
+#endif
+  uint8_t plan[PULSE400_MAX_CHANNELS]; // Fill the ports with the most pins in the set first, then the most free pins
+  uint8_t planned = 0;
+  uint8_t done = 0;
+  while ( planned < n && done != 0x1F ) {
+    int8_t best = -1;
+    uint8_t best_free = 0;
+    for ( uint8_t port = 0; port < 5; port++ ) {
+      if ( done & ( 1 << port ) ) continue;
+      uint8_t free = 0;
+      for ( uint8_t pin = PULSE400_PLAN_FIRST; pin < PULSE400_PLAN_PINS; pin++ ) {
+        if ( pulse400_valid( pin ) && pulse400_port( pin ) == port ) free++;
+      }
+      if ( free && ( best == -1 || cnt[port] > cnt[best] || ( cnt[port] == cnt[best] && free > best_free ) ) ) {
+        best = port;
+        best_free = free;
+      }
+    }
+    if ( best == -1 ) break;
+    done |= 1 << best;
+    for ( uint8_t i = 0; i < n && planned < n && planned < PULSE400_MAX_CHANNELS; i++ ) { // Keep the pins already there
+      if ( pulse400_valid( pins[i] ) && pulse400_port( pins[i] ) == best ) plan[planned++] = pins[i];
+    }
+    for ( uint8_t pin = PULSE400_PLAN_FIRST; pin < PULSE400_PLAN_PINS && planned < n && planned < PULSE400_MAX_CHANNELS; pin++ ) {
+      bool used = false;
+      for ( uint8_t i = 0; i < n; i++ ) used = used || pins[i] == pin;
+      if ( !used && pulse400_valid( pin ) && pulse400_port( pin ) == best ) plan[planned++] = pin;
+    }
+  }
+  out.print( "suggest" );
+  for ( uint8_t i = 0; i < planned; i++ ) {
+    out.print( ',' ); out.print( plan[i] );
+  }
+  out.println();
+  return *this;
+}
+
+#else
+
+Pulse400& Pulse400::portPlan( Print& out, const int8_t pins[], uint8_t n ) {
+  out.println( "no port map for this board" );
+  return *this;
+}
+
+#endif
+
 void PULSE400_ISR( void ) {
 #ifdef PULSE400_ENABLE_ISR  
   Pulse400::instance->handleTimerInterrupt();
+#ifndef PULSE400_USE_INTERVALTIMER
+  if ( Pulse400::instance->hook_pending ) { // AVR: run deferred hooks at the tail of the timer ISR
+    Pulse400::instance->hook_run();
+  }
+#endif
 #endif
 }
 
+void PULSE400_SOFT_ISR( void ) {
+#if defined( PULSE400_SPLIT_ISR )
+  Pulse400::instance->split_prepare(); // Bottom half first, the next edge group may be due in a few microseconds
+#endif
+  Pulse400::instance->hook_run();
+}
+
 void Pulse400::timer_start( void ) {
+  cli();
+  if ( qctl.change ) { // Nothing is being output: the first frame rises and falls with the new queue
+    qctl.change = false;
+    qctl.active ^= 1;
+  }
   qctl.next = PULSE400_JMP_HIGH;
+  sei();
   instance = this;
 #ifdef PULSE400_USE_INTERVALTIMER
+#if defined( PULSE400_SPLIT_ISR )
+  hook_vector( true );
+#endif
   timer.begin( PULSE400_ISR, 2 ); // interval 1 doesn't seem to work on Teensy LC
   timer.priority( 0 ); 
+#elif defined( PULSE400_AVR_NAKED )
+  cli();
+  TCCR1A = 0; // Normal mode, prescaler 8: compare A schedules every edge relative to the previous one
+  TCCR1B = 1 << CS11;
+  GPIOR0 = 0; 
+  OCR1A = TCNT1 + 2 * PULSE400_TICKS_PER_US;
+  TIFR1 = 1 << OCF1A;
+  TIMSK1 = 1 << OCIE1A;
+  sei();
 #else 
   Timer1.initialize(); 
   Timer1.attachInterrupt( PULSE400_ISR, 1 );
@@ -249,17 +831,31 @@ void Pulse400::timer_start( void ) {
 void Pulse400::timer_stop( void ) {
 #ifdef PULSE400_USE_INTERVALTIMER
   timer.end();
+#elif defined( PULSE400_AVR_NAKED )
+  TIMSK1 = 0;
+  GPIOR0 = 0;
 #else 
   Timer1.detachInterrupt();
 #endif  
 }
 
 Pulse400& Pulse400::sync( void ) {
+  poll(); // Lazy mode: the frame that starts now must have the latest pulses
   cli();
-  if ( qctl.next == PULSE400_JMP_HIGH ) { 
+  if ( mode == PULSE400_MODE_ONESHOT ) { 
+    if ( qctl.next == PULSE400_JMP_IDLE ) { // Generator is idle: start a frame right now
+      frame_start();
+    } else { // Frame or off-time guard in progress: start the next frame as soon as the guard expires
+      oneshot_pending = true;
+    }
+  } else if ( qctl.next == PULSE400_JMP_HIGH ) { 
 #ifdef PULSE400_USE_INTERVALTIMER
     timer.end();
     handleTimerInterrupt();
+#elif defined( PULSE400_AVR_NAKED )
+    OCR1A = TCNT1; // The rising edges are due now, the next compare is relative to this
+    handleTimerInterrupt();
+    TIFR1 = 1 << OCF1A;
 #else 
     Timer1.restart();
 #endif  
@@ -267,6 +863,486 @@ Pulse400& Pulse400::sync( void ) {
   sei();
   return *this;
 }
+
+// One-shot mode: no free running period, every sync() outputs a single frame
+
+Pulse400& Pulse400::oneshot( bool v /* = true */ ) {
+  blocking( false );
+  cli();
+  mode = v ? PULSE400_MODE_ONESHOT : PULSE400_MODE_FREE;
+  oneshot_pending = false;
+  if ( !v && qctl.next == PULSE400_JMP_IDLE ) { // Resume free running
+    frame_start();
+  }
+  sei();
+  return *this;
+}
+
+// Minimum off-time between the last falling edge and the next frame in one-shot mode
+// At least 1 us: the guard interval is a timer interval and 0 doesn't fire
+
+Pulse400& Pulse400::minGap( uint16_t us /* = PULSE400_MIN_GAP */ ) {
+  cycle_gap = us ? us : 1;
+  return *this;
+}
+
+// Failsafe: all channels switch to pw if update() isn't called for frames frames (0 = off)
+// The failsafe queue is built here (and on attach/detach), the ISR only selects it
+
+Pulse400& Pulse400::failsafe( uint8_t frames, uint16_t pw /* = PULSE400_DEFAULT_PULSE */ ) {
+  failsafe_pw = constrain( pw, PULSE400_MIN_PULSE, cycle_width + PULSE400_MIN_PULSE - 1 ) - PULSE400_MIN_PULSE;
+  init_failsafe();
+  cli();
+  failsafe_frames = frames; // Takes effect at the next point of no return
+  stale_cnt = 0;
+  sei();
+  return *this;
+}
+
+// Returns true while the failsafe queue is being output
+
+bool Pulse400::failsafe( void ) {
+  return failsafe_active;
+}
+
+// All entries have the same pulse width so the ISR is either before or past the (single) falling edge group
+
+void Pulse400::init_failsafe( void ) {
+  cli(); // The ISR may be using it
+  int queue_cnt = 0;
+  for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
+    if ( channel[ch].pin != PULSE400_UNUSED ) {
+      failsafe_queue[queue_cnt].id = ch;
+      failsafe_queue[queue_cnt].pw = failsafe_pw; // All equal: sorted by definition
+      queue_cnt++;
+    }
+  }
+  failsafe_queue[queue_cnt].id = PULSE400_END_FLAG;
+  init_groups( failsafe_queue, 0, queue_cnt - 1 );
+  sei();
+}
+
+// Measures the real pulse width of id_channel with its output looped back to an Rc400 PWM input (rc_channel)
+// For each group size the channel shares its falling edge with more channels (the rest are moved 400 us later)
+// The measured error becomes the latency compensation for that group size, returns false if no signal was seen
+// The channels output pw during calibration: don't run this with motors connected
+
+bool Pulse400::calibrate( Rc400& rc, int8_t id_channel, uint8_t rc_channel /* = 0 */, uint16_t pw /* = 1500 */, uint8_t samples /* = 16 */ ) {
+  uint16_t saved[PULSE400_MAX_CHANNELS];
+  for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
+    saved[ch] = pulse( ch );
+  }
+  for ( int n = 0; n <= PULSE400_MAX_CHANNELS; n++ ) {
+    latency_comp[n] = 0;
+  }
+#if defined( PULSE400_QUEUE_GROUPS )
+  int sizes = channel_count();
+#else
+  int sizes = 1; // Edges aren't grouped: a single compensation value
+#endif
+  bool result = true;
+  for ( int n = 1; n <= sizes && result; n++ ) {
+    int in_group = 1;
+    for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
+      if ( ch != id_channel && channel[ch].pin != PULSE400_UNUSED ) {
+        pulse( ch, in_group < n ? pw : pw + 400, true );
+        if ( in_group < n ) in_group++;
+      }
+    }
+    pulse( id_channel, pw, true );
+    update();
+    int32_t sum = 0;
+    uint8_t cnt = 0;
+    uint8_t skip = 0;
+    uint16_t f = frames();
+    uint32_t start = millis();
+    while ( cnt < samples ) {
+      if ( millis() - start > 1000 ) { // No frames or no loopback signal
+        result = false;
+        break;
+      }
+      if ( frames() == f ) continue;
+      f = frames();
+      if ( ++skip < 4 ) continue; // Let the new queue and the input settle
+      int v = rc.read( rc_channel );
+      if ( v > 0 && rc.connected() ) {
+        sum += v - (int) pw;
+        cnt++;
+      }
+    }
+    if ( cnt ) latency_comp[n] = constrain( ( sum + cnt / 2 ) / cnt, -100, 100 );
+  }
+  for ( int n = sizes + 1; n <= PULSE400_MAX_CHANNELS; n++ ) { // Larger groups: assume the largest one measured
+    latency_comp[n] = latency_comp[sizes];
+  }
+  for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
+    if ( channel[ch].pin != PULSE400_UNUSED ) pulse( ch, saved[ch], true );
+  }
+  update();
+  return result;
+}
+
+// Set or read the compensation table, e.g. to store the calibration in EEPROM
+
+Pulse400& Pulse400::latency( uint8_t group_size, int8_t us ) {
+  if ( group_size > 0 && group_size <= PULSE400_MAX_CHANNELS ) {
+    latency_comp[group_size] = us;
+#if defined( PULSE400_AVR_NAKED )
+    dirty[0] = dirty[1] = PULSE400_DIRTY_ALL; // The assembly ISR steps are pre-shifted as well
+#endif
+    update(); // Rebuild the queues with the new table
+  }
+  return *this;
+}
+
+int8_t Pulse400::latency( uint8_t group_size ) {
+  return group_size > 0 && group_size <= PULSE400_MAX_CHANNELS ? latency_comp[group_size] : 0;
+}
+
+// Adaptive mode: every period ends the minimum off-time plus the ESC's frame gap after the widest pulse
+
+Pulse400& Pulse400::adaptive( bool v /* = true */, uint16_t esc_gap /* = 0 */ ) {
+  blocking( false );
+  cli();
+  cycle_esc_gap = esc_gap;
+  mode = v ? PULSE400_MODE_ADAPTIVE : PULSE400_MODE_FREE;
+  oneshot_pending = false;
+  if ( qctl.next == PULSE400_JMP_IDLE ) { // Leaving one-shot mode: resume free running
+    frame_start();
+  }
+  sei();
+  return *this;
+}
+
+// Calls f when a frame starts (rising edges)
+// Hooks run inside the timer ISR and must be short, deferred hooks run with interrupts enabled and may call update()
+
+Pulse400& Pulse400::onFrame( pulse400_hook_t f, bool deferred /* = false */ ) {
+  hook_vector( deferred );
+  cli();
+  hook_frame = f;
+  hook_deferred = deferred ? hook_deferred | PULSE400_HOOK_FRAME : hook_deferred & ~PULSE400_HOOK_FRAME;
+  sei();
+  return *this;
+}
+
+// Calls f lead microseconds before the point of no return (the last moment an update() makes it into the next frame)
+// A lead longer than the minimum pulse width is taken from the off-time of the previous frame
+
+Pulse400& Pulse400::onDeadline( pulse400_hook_t f, uint16_t lead /* = 0 */, bool deferred /* = false */ ) {
+  hook_vector( deferred );
+  cli();
+  hook_deadline = f;
+  hook_lead = lead;
+  hook_deferred = deferred ? hook_deferred | PULSE400_HOOK_DEADLINE : hook_deferred & ~PULSE400_HOOK_DEADLINE;
+  sei();
+  return *this;
+}
+
+// Timed events: a pin edge and/or a callback offset microseconds after the frame start, every div'th frame, 
+// repeat times (0: until cancel()). They're sorted into the falling edge queue and run by the same timer interrupt
+// The offset is limited to the range of the falling edges: from the minimum pulse to the end of the period
+// Callbacks run inside the ISR like onFrame(), returns an event id or -1 if all PULSE400_MAX_EVENTS are in use
+
+int8_t Pulse400::event( int8_t pin, uint8_t edge, uint16_t offset, pulse400_hook_t f /* = NULL */, uint16_t div /* = 1 */, uint8_t repeat /* = 0 */ ) {
+  if ( pin > -1 && !pulse400_valid( pin ) ) return -1;
+  for ( int e = 0; e < PULSE400_MAX_EVENTS; e++ ) {
+    if ( events[e].div == 0 ) {
+#if !defined( PULSE400_SHIFT_595 )
+      if ( pin > -1 ) pinMode( pin, OUTPUT );
+#endif
+      events[e].pin = pin;
+      events[e].edge = pin > -1 ? edge : PULSE400_EDGE_NONE;
+      events[e].f = f;
+      events[e].repeat = repeat;
+      events[e].pw = constrain( offset, cycle_deadline, cycle_width + PULSE400_MIN_PULSE - 1 ) - PULSE400_MIN_PULSE;
+#if !defined( PULSE400_OPTIMIZE_STANDARD )
+      if ( pin > -1 ) {
+        events[e].map.port = pulse400_port( pin );
+        events[e].map.mask = 1UL << pulse400_bit( pin );
+      }
+#endif
+      uint8_t d = 1;
+      while ( d < div && d < 128 ) d <<= 1;
+      events[e].div = d; // Not queued yet: the ISR can't see it
+      dirty[0] = dirty[1] = PULSE400_DIRTY_ALL;
+      update();
+      return e;
+    }
+  }
+  return -1;
+}
+
+// Moves an event to a new offset, like pulse() does for a channel
+
+Pulse400& Pulse400::event( int8_t id_event, uint16_t offset ) {
+  if ( id_event > -1 && id_event < PULSE400_MAX_EVENTS && events[id_event].div ) {
+    events[id_event].pw = constrain( offset, cycle_deadline, cycle_width + PULSE400_MIN_PULSE - 1 ) - PULSE400_MIN_PULSE;
+    dirty[0] |= 1UL << ( PULSE400_MAX_CHANNELS + id_event );
+    dirty[1] |= 1UL << ( PULSE400_MAX_CHANNELS + id_event );
+    update();
+  }
+  return *this;
+}
+
+Pulse400& Pulse400::cancel( int8_t id_event ) {
+  if ( id_event > -1 && id_event < PULSE400_MAX_EVENTS && events[id_event].div ) {
+    events[id_event].div = 0; // The ISR skips it until the queues are rebuilt
+    dirty[0] = dirty[1] = PULSE400_DIRTY_ALL;
+    update();
+  }
+  return *this;
+}
+
+// Called from the ISR when a timed event is reached, returns true if it must run in this frame
+
+bool Pulse400::frame_event( event_struct_t& ev ) {
+  if ( ev.div == 0 || ( frame_cnt & ( ev.div - 1 ) ) ) {
+    return false;
+  }
+  if ( ev.repeat && --ev.repeat == 0 ) { // Last run of a one-shot event
+    ev.div = 0;
+    event_expired = true;
+  }
+  return true;
+}
+
+// Blocking mode: the timer is stopped after the running frame and emitFrame() outputs each frame from the main loop
+// Frame hooks, one-shot/adaptive timing and the latency compensation don't apply
+
+Pulse400& Pulse400::blocking( bool v /* = true */ ) {
+  if ( v == ( mode == PULSE400_MODE_BLOCKING ) ) return *this;
+  cli();
+  oneshot_pending = false;
+  mode = v ? PULSE400_MODE_BLOCKING : PULSE400_MODE_FREE;
+  sei();
+  if ( v ) {
+    if ( channel_count() > 0 ) { 
+      while ( qctl.next != PULSE400_JMP_IDLE ); // Let the running frame finish, the guard state stops the timer
+    } else {
+      qctl.next = PULSE400_JMP_IDLE;
+    }
+    emit_last = micros();
+#if defined( PULSE400_TICKS_DWT )
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#elif defined( PULSE400_TICKS_TCNT1 )
+    TIMSK1 = 0; // Timer1 as a plain counter: normal mode, prescaler 8
+    TCCR1A = 0;
+    TCCR1B = 1 << CS11;
+#endif    
+  } else if ( channel_count() > 0 ) {
+    timer_start();
+  }
+  return *this;
+}
+
+// Blocking mode: waits for the minimum off-time, then makes the frame final like the point of no return does
+// Returns the queue to output with interrupts disabled
+
+queue_t * Pulse400::emit_start( void ) {
+  poll();
+  while ( micros() - emit_last < cycle_gap );
+  cli();
+  frame_deadline();
+  return frame_queue();
+}
+
+// Blocking mode: frame bookkeeping after the last falling edge
+
+void Pulse400::emit_end( uint16_t pw ) {
+  cli();
+  frame_end( pw );
+  qctl.next = PULSE400_JMP_IDLE;
+  emit_last = micros();
+  sei();
+#ifndef PULSE400_USE_INTERVALTIMER
+  if ( hook_pending ) { // No timer interrupt tail to run the motion step from
+    hook_run();
+    sei(); // hook_run() returns with interrupts masked, like the ISR tail it was written for
+  }
+#endif
+}
+
+// Teensy: deferred hooks run from the (otherwise unused) software interrupt at a lower priority than the timer
+
+void Pulse400::hook_vector( bool deferred ) {
+  instance = this;
+#ifdef PULSE400_USE_INTERVALTIMER
+  if ( deferred ) {
+    attachInterruptVector( IRQ_SOFTWARE, PULSE400_SOFT_ISR );
+    NVIC_SET_PRIORITY( IRQ_SOFTWARE, 208 );
+    NVIC_ENABLE_IRQ( IRQ_SOFTWARE );
+  }
+#endif  
+}
+
+// Called from the ISR: runs a hook or schedules it for deferred execution
+
+void Pulse400::hook_call( uint8_t hook ) {
+  pulse400_hook_t f = hook == PULSE400_HOOK_FRAME ? hook_frame : hook_deadline;
+  if ( hook == PULSE400_HOOK_DEADLINE && lazy_mode && lazy_pending ) { // Too long for the ISR: always deferred
+    hook_pending |= PULSE400_HOOK_COMMIT;
+#ifdef PULSE400_USE_INTERVALTIMER
+    NVIC_SET_PENDING( IRQ_SOFTWARE );
+#endif
+  }
+  if ( f ) {
+    if ( hook_deferred & hook ) {
+      hook_pending |= hook;
+#ifdef PULSE400_USE_INTERVALTIMER
+      NVIC_SET_PENDING( IRQ_SOFTWARE );
+#endif
+    } else {
+      f();
+    }
+  }
+}
+
+// Runs the deferred hooks with interrupts enabled, from the software interrupt (Teensy) or the tail of the timer ISR (AVR)
+
+void Pulse400::hook_run( void ) {
+  if ( hook_busy ) return; // AVR: already running further down the stack, it picks up the new hooks as well
+  hook_busy = true;
+  for (;;) {
+    cli();
+    uint8_t pending = hook_pending;
+    hook_pending = 0;
+    if ( !pending ) break;
+    sei();
+    if ( ( pending & PULSE400_HOOK_FRAME ) && hook_frame ) hook_frame();
+    if ( ( pending & PULSE400_HOOK_DEADLINE ) && hook_deadline ) hook_deadline();
+    if ( pending & PULSE400_HOOK_COMMIT ) poll(); // After the deadline hook: picks up its pulse() calls
+    if ( pending & PULSE400_HOOK_MOTION ) motion_step();
+  }
+  hook_busy = false;
+#ifdef PULSE400_USE_INTERVALTIMER
+  sei(); // Software interrupt: back to the state we were called in
+#endif
+}
+
+// Starts a new frame immediately, call with interrupts disabled
+
+void Pulse400::frame_start( void ) {
+  qctl.next = PULSE400_JMP_HIGH;
+#if defined( PULSE400_AVR_NAKED )
+  OCR1A = TCNT1;
+  handleTimerInterrupt();
+  TIFR1 = 1 << OCF1A; // The guard state disabled the compare interrupt
+  TIMSK1 |= 1 << OCIE1A;
+#else
+  handleTimerInterrupt();
+#ifndef PULSE400_USE_INTERVALTIMER
+  Timer1.restart();
+#endif  
+#endif  
+}
+
+// Called from the ISR when the one-shot off-time guard has expired, returns true if a new frame must start
+
+bool Pulse400::frame_guard( void ) {
+  if ( oneshot_pending || ( mode != PULSE400_MODE_ONESHOT && mode != PULSE400_MODE_BLOCKING ) ) {
+    oneshot_pending = false;
+    qctl.next = PULSE400_JMP_HIGH;
+    return true;
+  }
+  qctl.next = PULSE400_JMP_IDLE; // Nothing requested: stop the timer until the next sync()
+  STOP_TIMER();
+  return false;
+}
+
+// Called from the ISR after the rising edges, sets the next state and returns the interval to it
+
+int16_t Pulse400::frame_high( void ) {
+  hook_call( PULSE400_HOOK_FRAME );
+  if ( hook_armed() && hook_lead < cycle_deadline ) { // Deadline hook inside the minimum pulse
+    qctl.next = PULSE400_JMP_HOOK;
+    hook_next = PULSE400_JMP_DEADLINE;
+    hook_rest = hook_lead;
+    return cycle_deadline - hook_lead;
+  }
+  if ( hook_armed() && mode == PULSE400_MODE_ONESHOT ) { // Frame start can't be predicted: as early as possible
+    hook_call( PULSE400_HOOK_DEADLINE );
+  }
+  qctl.next = PULSE400_JMP_DEADLINE;
+  return cycle_deadline;
+}
+
+// Called from the ISR at the point of no return: switches to the newest queue, or to the failsafe queue when
+// update() wasn't called for failsafe_frames frames. Returns true if the queues were switched
+
+bool Pulse400::frame_deadline( void ) {
+  bool switched = qctl.change;
+  if ( switched ) { 
+    qctl.change = false;
+    qctl.active = qctl.active ^ 1;
+    switch_missed = false;
+    if ( commit_deferred ) { // Rebuild the other queue right away
+      commit_deferred = false;
+      hook_pending |= PULSE400_HOOK_COMMIT;
+#ifdef PULSE400_USE_INTERVALTIMER
+      NVIC_SET_PENDING( IRQ_SOFTWARE );
+#endif
+    }
+  } else if ( switch_held ) {
+    switch_missed = true;
+  }
+  if ( stale_cnt < 255 ) stale_cnt++;
+  failsafe_active = failsafe_frames && stale_cnt >= failsafe_frames;
+  qctl.next = 0;
+  return switched;
+}
+
+// Called from the ISR in the JMP_HOOK state, returns the remaining interval (0: continue with the next state right away)
+
+int16_t Pulse400::frame_hook( void ) {
+  hook_call( PULSE400_HOOK_DEADLINE );
+  qctl.next = hook_next;
+  return hook_rest;
+}
+
+// Called from the ISR after the last falling edge of a frame, sets the next state and returns the interval to it
+
+int16_t Pulse400::frame_end( uint16_t pw ) {
+  frame_cnt++;
+  uint32_t now = micros();
+  if ( now - rate_start >= 1000000UL ) { // Per second frame rate counter
+    frame_rate = frame_cnt - rate_cnt;
+    rate_cnt = frame_cnt;
+    rate_start = now;
+  }
+  if ( telemetry ) {
+    telemetry->capture();
+  }
+#if defined( PULSE400_MOTION )
+  if ( motion_active ) { // Batched profile step for the next frame, too long for the ISR: always deferred
+    hook_pending |= PULSE400_HOOK_MOTION;
+#ifdef PULSE400_USE_INTERVALTIMER
+    NVIC_SET_PENDING( IRQ_SOFTWARE );
+#endif
+  }
+#endif
+  if ( mode == PULSE400_MODE_ONESHOT || mode == PULSE400_MODE_BLOCKING ) {
+    qctl.next = PULSE400_JMP_GUARD;
+    return cycle_gap;
+  }
+  qctl.next = PULSE400_JMP_HIGH;
+  int16_t gap = cycle_width - pw;
+  if ( mode == PULSE400_MODE_ADAPTIVE && cycle_gap + cycle_esc_gap < gap ) { // pw is the widest pulse
+    gap = cycle_gap + cycle_esc_gap;
+  }
+  if ( hook_armed() && hook_lead >= cycle_deadline ) { // Deadline hook inside the off-time
+    uint16_t lead = hook_lead - cycle_deadline;
+    if ( gap > lead ) { 
+      qctl.next = PULSE400_JMP_HOOK;
+      hook_next = PULSE400_JMP_HIGH;
+      hook_rest = lead;
+      return gap - lead;
+    }
+    hook_call( PULSE400_HOOK_DEADLINE ); // Off-time is too short: as early as possible
+  }
+  return gap;
+}
   
 #if defined( PULSE400_OPTIMIZE_STANDARD )
 
@@ -277,39 +1353,99 @@ Pulse400& Pulse400::sync( void ) {
 
 void Pulse400::handleTimerInterrupt( void ) {
   int16_t next_interval = 0;
-  queue_t * q = &queue[qctl.active];
+  queue_t * q = frame_queue();
+  if ( qctl.next == PULSE400_JMP_GUARD && !frame_guard() ) { // One-shot mode: idle until the next sync()
+    return;
+  }
+  if ( qctl.next == PULSE400_JMP_HOOK && ( next_interval = frame_hook() ) ) { // Deadline hook, then wait for the next state
+    SET_TIMER( next_interval, PULSE400_ISR );
+    return;
+  }
   if ( qctl.next == PULSE400_JMP_HIGH ) { // Set all pins HIGH
     qctl.next = 0; // Point the queue pointer at the start of the queue
     while( (*q)[qctl.next].id != PULSE400_END_FLAG ) {
-      digitalWrite( channel[(*q)[qctl.next].id].pin, HIGH );
+      if ( (*q)[qctl.next].id < PULSE400_MAX_CHANNELS && ( frame_cnt & ( channel[(*q)[qctl.next].id].div - 1 ) ) == 0 ) { // Frame divider
+        digitalWrite( channel[(*q)[qctl.next].id].pin, HIGH );
+      }
       qctl.next++;
     }
-    qctl.next = PULSE400_JMP_DEADLINE;
-    SET_TIMER( cycle_deadline, PULSE400_ISR );
+    SET_TIMER( frame_high(), PULSE400_ISR );
     return;
   } 
   if ( qctl.next == PULSE400_JMP_DEADLINE ) { // Point of no return 
-    if ( qctl.change ) { // TODO: shortcut if PONR == next LOW
-      qctl.change = false;
-      qctl.active = qctl.active ^ 1;
-      q = &queue[qctl.active];
-    }
-    qctl.next = 0;
-    next_interval = ( (*q)[qctl.next].pw + PULSE400_MIN_PULSE ) - cycle_deadline;
+    frame_deadline(); // TODO: shortcut if PONR == next LOW
+    q = frame_queue();
+    next_interval = latency_adjust( ( (*q)[qctl.next].pw + PULSE400_MIN_PULSE ) - cycle_deadline, 0, PULSE400_GROUP_SIZE( (*q)[qctl.next] ) );
   } 
   if ( next_interval == 0 ) {    
-    uint16_t previous_pw = (*q)[qctl.next].pw;
-    // Possible fix: if pulses too close together merge them!!! PULSE400_MINIMUM_INTERVAL
-    while ( next_interval ) { // Process equal pulse widths in the same timer interrupt period
-      digitalWrite( channel[(*q)[qctl.next].id].pin, LOW );
-      next_interval = (*q)[++qctl.next].pw - previous_pw;
-    }
+    uint16_t previous_pw;
+    uint8_t done;
+    do { // Timed events may be due together with a falling edge group
+      previous_pw = (*q)[qctl.next].pw;
+      done = PULSE400_GROUP_SIZE( (*q)[qctl.next] );
+      if ( (*q)[qctl.next].id >= PULSE400_MAX_CHANNELS ) { 
+        event_run( (*q)[qctl.next].id );
+        qctl.next++;
+      } else {
+        // Possible fix: if pulses too close together merge them!!! PULSE400_MINIMUM_INTERVAL
+        do { // Process equal pulse widths in the same timer interrupt period
+          digitalWrite( channel[(*q)[qctl.next].id].pin, LOW );
+          qctl.next++;
+        } while ( (*q)[qctl.next].id < PULSE400_MAX_CHANNELS && (*q)[qctl.next].pw == previous_pw ); // Stops at events and the sentinel
+      }
+    } while ( (*q)[qctl.next].id != PULSE400_END_FLAG && (*q)[qctl.next].pw - previous_pw <= PULSE400_MINIMUM_INTERVAL );
     if ( (*q)[qctl.next].id == PULSE400_END_FLAG ) { 
-      next_interval = cycle_width - previous_pw;
-      qctl.next = PULSE400_JMP_HIGH; 
+      next_interval = latency_adjust( frame_end( previous_pw ), done, 0 );
+    } else {
+      next_interval = latency_adjust( (*q)[qctl.next].pw - previous_pw, done, PULSE400_GROUP_SIZE( (*q)[qctl.next] ) );
     }
   } 
   SET_TIMER( next_interval, PULSE400_ISR );
 }
 
+// Blocking mode: outputs a single frame without the timer, returns after the last falling edge
+
+Pulse400& Pulse400::emitFrame( void ) {
+  if ( mode != PULSE400_MODE_BLOCKING ) return *this;
+  queue_t * q = emit_start();
+  for ( uint8_t i = 0; (*q)[i].id != PULSE400_END_FLAG; i++ ) { // Set all pins HIGH
+    if ( (*q)[i].id < PULSE400_MAX_CHANNELS && ( frame_cnt & ( channel[(*q)[i].id].div - 1 ) ) == 0 ) {
+      digitalWrite( channel[(*q)[i].id].pin, HIGH );
+    }
+  }
+  pulse400_ticks_t start = PULSE400_TICKS();
+  sei();
+  uint16_t previous_pw = 0;
+  while ( (*q)[qctl.next].id != PULSE400_END_FLAG ) {
+    previous_pw = (*q)[qctl.next].pw;
+    emit_wait( start, previous_pw + PULSE400_MIN_PULSE ); // Interrupts are masked from here to the edge
+    if ( (*q)[qctl.next].id >= PULSE400_MAX_CHANNELS ) { 
+      event_run( (*q)[qctl.next].id );
+      qctl.next++;
+    } else {
+      do { 
+        digitalWrite( channel[(*q)[qctl.next].id].pin, LOW );
+        qctl.next++;
+      } while ( (*q)[qctl.next].id < PULSE400_MAX_CHANNELS && (*q)[qctl.next].pw == previous_pw );
+    }
+    sei();
+  }
+  emit_end( previous_pw );
+  return *this;
+}
+
+// Timed event: the edge first, then the callback
+
+void Pulse400::event_run( uint8_t id ) {
+  event_struct_t& ev = events[id - PULSE400_MAX_CHANNELS];
+  if ( frame_event( ev ) ) {
+    switch ( ev.edge ) {
+      case PULSE400_EDGE_HIGH: digitalWrite( ev.pin, HIGH ); break;
+      case PULSE400_EDGE_LOW: digitalWrite( ev.pin, LOW ); break;
+      case PULSE400_EDGE_TOGGLE: digitalWrite( ev.pin, !digitalRead( ev.pin ) ); break;
+    }
+    if ( ev.f ) ev.f();
+  }
+}
+
 #endif
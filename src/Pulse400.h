@@ -10,13 +10,46 @@
 
 #define PULSE400_MAX_CHANNELS 8 // Maximum value: 31
 #define MULTI400_NO_OF_CHANNELS 8 // Maximum value: 31
-#define RC400_NO_OF_CHANNELS 6
+#define MULTI400_Q14 16384 // 1.0 in the mixer's fixed point format
+#define MULTI400_CURVE_POINTS 17 // Motor linearisation table: 0, 62.5, 125 ... 1000
+#define RC400_NO_OF_CHANNELS 16 // PWM mode: first 6, IBUS: first 14
+#define TELEMETRY400_RECORDS 4 // Telemetry ring buffer size in records
+#define PULSE400_MAX_DIVIDER 8 // Highest per channel frame divider (power of two), costs two pins_high bitmaps per step
+#define PULSE400_MAX_EVENTS 4 // Timed edges/callbacks merged into the frame, channels + events: max 31
 
 // Turn options on/off for debugging/testing/development
 
 #define PULSE400_OPTIMIZE_ARDUINO_UNO
 #define PULSE400_OPTIMIZE_TEENSY_3X
 #define PULSE400_ENABLE_ISR
+#define PULSE400_LATE_UPDATE // Apply updates to the running frame when the channel's falling edge is still ahead
+#define PULSE400_LATENCY_COMP // Pre-shift falling edges by the latency measured with calibrate()
+#define PULSE400_MOTION // Per channel motion profiles (move()), advanced by the generator once per frame
+
+// Queue memory layout, define one of these or leave both out for the default (compact on AVR, fast on Teensy)
+// See the README for the RAM used by each layout
+
+//#define PULSE400_QUEUE_COMPACT // Least RAM: the ISR looks up falling edge bitmaps in a shared per channel table
+//#define PULSE400_QUEUE_FAST // Fastest ISR: aligned non-bitfield entries that carry precomputed falling edge bitmaps
+
+// UNO only: drive Timer1 directly (compare A, no TimerOne) and run the falling edge groups in an assembly ISR
+// Needs PULSE400_QUEUE_FAST, uses GPIOR0-2 and limits the period to 32 ms (see the README)
+// Experimental: the assembly ISR hasn't been verified in a simulator or on a board yet
+
+//#define PULSE400_AVR_NAKED
+
+// Teensy only: the timer interrupt just writes the falling edge group the software interrupt prepared for it
+// Needs the fast queue layout, shares IRQ_SOFTWARE with the deferred hooks (see the README)
+
+//#define PULSE400_SPLIT_ISR
+
+// Shift register outputs: channel and event pins are the outputs of daisy chained 74HC595s on the SPI bus instead of
+// MCU pins, pin 8 * n + q is output Qq of register n (register 0 is wired to MOSI). Replaces the board's port backend,
+// every edge group costs one chain write (see the README)
+
+//#define PULSE400_SHIFT_595 3 // Number of registers in the chain
+#define PULSE400_SHIFT_LATCH 10 // RCLK (latch) pin
+#define PULSE400_SHIFT_CLOCK 8000000 // SPI clock in Hz
 
 #define PULSE400_DEFAULT_PULSE 1000
 #define PULSE400_MIN_PULSE 360
@@ -24,13 +57,47 @@
 #define PULSE400_END_FLAG 31
 #define PULSE400_JMP_HIGH 32 // fits in qctl.next (6 bit = 0..63)
 #define PULSE400_JMP_DEADLINE 33
-#define PULSE400_UNUSED 31
+#define PULSE400_JMP_GUARD 34 // One-shot mode: minimum off-time after the last falling edge
+#define PULSE400_JMP_IDLE 35 // One-shot mode: timer stopped, waiting for sync()
+#define PULSE400_JMP_HOOK 36 // onDeadline() hook, lead time before the point of no return
+#define PULSE400_UNUSED -1
+#define PULSE400_MIN_GAP 200 // Default minimum off-time between one-shot frames
+#define PULSE400_DIRTY_ALL 0x80000000UL // Queue must be rebuilt from scratch (channel attached or detached)
+
+#define PULSE400_MODE_FREE 0 // Free running at frequency()
+#define PULSE400_MODE_ONESHOT 1 // One frame per sync() call
+#define PULSE400_MODE_ADAPTIVE 2 // Period sized to the widest pulse, never slower than frequency()
+#define PULSE400_MODE_BLOCKING 3 // No timer interrupts: the main loop outputs every frame with emitFrame()
+
+#define PULSE400_EDGE_NONE 0 // Timed events: callback only
+#define PULSE400_EDGE_HIGH 1
+#define PULSE400_EDGE_LOW 2
+#define PULSE400_EDGE_TOGGLE 3
+
+#define PULSE400_MAX_ENTRIES ( PULSE400_MAX_CHANNELS + PULSE400_MAX_EVENTS ) // Queue ids: channels, then events
+
+#define PULSE400_HOOK_FRAME 1
+#define PULSE400_HOOK_DEADLINE 2
+#define PULSE400_HOOK_COMMIT 4 // Deferred queue rebuild: lazy mode, or a commit() that waited for the queue switch
+#define PULSE400_HOOK_MOTION 8 // Motion profiles: deferred step after the last falling edge
 
 #define RC400_IDLE_DISCONNECT 100000
+#define RC400_SERIAL_NONE 0
+#define RC400_SERIAL_SBUS 1 // 25 byte frames: 0x0F, 16 x 11 bit channels, flags, 0x00
+#define RC400_SERIAL_IBUS 2 // 32 byte frames: 0x20 0x40, 14 x 16 bit channels, checksum
+#define RC400_SBUS_FRAME 25
+#define RC400_IBUS_FRAME 32
+
+#define TELEMETRY400_SYNC 0xA5 // First byte of every telemetry record
 
 #define PINHIGHD( _pin ) PORTD |= ( 1 << _pin );
 #define PINLOWD( _pin ) PORTD &= ~( 1 << _pin );
 
+#if defined( PULSE400_SHIFT_595 )
+  #undef PULSE400_OPTIMIZE_ARDUINO_UNO
+  #undef PULSE400_OPTIMIZE_TEENSY_3X
+#endif
+
 // Identify Teensy models
 
 #if defined(__MKL26Z64__)
@@ -50,51 +117,357 @@
   #define __TEENSY_36__
 #endif
 
+#if defined( PULSE400_AVR_NAKED ) && ( !defined( __AVR_ATmega328P__ ) || !defined( PULSE400_OPTIMIZE_ARDUINO_UNO ) )
+  #undef PULSE400_AVR_NAKED
+#endif
+
 // For Teensy 3.0/3.1/3.2/3.5/3.6/LC use Teensyduino intervalTimer
 
 #if defined( __TEENSY_3X__ )
   #define PULSE400_USE_INTERVALTIMER
   #define SET_TIMER( _interval, _func ) timer.begin( _func, _interval )
+  #define STOP_TIMER() timer.end()
+#elif defined( PULSE400_AVR_NAKED )
+  #define SET_TIMER( _interval, _func ) pulse400_compare( _interval ) 
+  #define STOP_TIMER() ( TIMSK1 &= ~( 1 << OCIE1A ) )
+  #define PULSE400_NAKED_RUN 1 // GPIOR0: the assembly ISR handles the next compare match
+  #define PULSE400_NAKED_INDEX 2 // GPIOR0: GPIOR1/2 point at the group the ISR is armed for (instead of qctl.next)
+  #define PULSE400_NAKED_LEAD 4 // Minimum timer ticks between setting and reaching a compare match
+  #define PULSE400_NAKED_MIN_STEP 16 // Microseconds, closer groups are left to the C++ ISR
+  #define PULSE400_NAKED_MAX_STEP 16000 // Microseconds, longer steps are left to the C++ ISR: the assembly late check is signed
+  #define PULSE400_NAKED_MIN_FREQ 31 // Longest period the 16 bit compare register can schedule
 #else  
   #include <TimerOne.h>
   #define SET_TIMER( _interval, _func ) Timer1.setPeriod( _interval ) 
+  #define STOP_TIMER() Timer1.stop()
+#endif
+
+// Busy-wait time base for emitFrame() (blocking mode)
+
+#if defined( __TEENSY_3X__ ) && !defined( __TEENSY_LC__ )
+  #define PULSE400_TICKS_DWT
+  #define PULSE400_TICKS() ARM_DWT_CYCCNT // CPU cycle counter
+  #define PULSE400_TICKS_PER_US ( F_CPU / 1000000 )
+  typedef uint32_t pulse400_ticks_t;
+#elif defined( __AVR_ATmega328P__ )
+  #define PULSE400_TICKS_TCNT1
+  #define PULSE400_TICKS() TCNT1 // Timer1 free running at F_CPU / 8, its interrupts are off
+  #define PULSE400_TICKS_PER_US ( F_CPU / 8000000 )
+  typedef uint16_t pulse400_ticks_t;
+#else
+  #define PULSE400_TICKS() micros() // Teensy LC has no cycle counter
+  #define PULSE400_TICKS_PER_US 1
+  typedef uint32_t pulse400_ticks_t;
+#endif
+
+#if defined( PULSE400_AVR_NAKED )
+
+// Schedule the next compare match relative to the previous one (no drift), or as soon as possible when it's already late
+
+inline void pulse400_compare( uint16_t us ) {
+  uint16_t ticks = us * PULSE400_TICKS_PER_US;
+  uint16_t late = TCNT1 - OCR1A; // Ticks since the last compare match
+  OCR1A = ticks > late + PULSE400_NAKED_LEAD ? OCR1A + ticks : TCNT1 + PULSE400_NAKED_LEAD;
+}
+
+#endif
+
+#if !defined( PULSE400_QUEUE_COMPACT ) && !defined( PULSE400_QUEUE_FAST )
+  #if defined( __TEENSY_3X__ ) || defined( PULSE400_SHIFT_595 )
+    #define PULSE400_QUEUE_FAST
+  #else
+    #define PULSE400_QUEUE_COMPACT
+  #endif
+#endif
+
+#if defined( PULSE400_AVR_NAKED ) && !defined( PULSE400_QUEUE_FAST )
+  #error "PULSE400_AVR_NAKED needs PULSE400_QUEUE_FAST"
+#endif
+
+#if defined( PULSE400_SHIFT_595 ) && !defined( PULSE400_QUEUE_FAST )
+  #error "PULSE400_SHIFT_595 needs PULSE400_QUEUE_FAST"
+#endif
+
+// Pin to port/bit mapping for the optimized ISRs, usable at compile time (ports: A=0, B=1, C=2, D=3, E=4)
+
+struct pulse400_pin_t { 
+  uint8_t port; 
+  uint8_t bit; 
+};
+
+#if defined( PULSE400_SHIFT_595 )
+
+constexpr uint8_t pulse400_port( int8_t pin ) { return pin >> 3; } // Register in the chain
+constexpr uint8_t pulse400_bit( int8_t pin ) { return pin & 7; }
+constexpr bool pulse400_valid( int8_t pin ) { return pin >= 0 && pin < 8 * PULSE400_SHIFT_595; }
+
+#elif defined( __TEENSY_3X__ )
+
+static constexpr pulse400_pin_t teensy_pins[] = { 
+// A=0, B=1, C=2, D=3, E=4, every digital pin of the model
+  1, 16, // pin 0
+  1, 17, // pin 1
+  3,  0, // pin 2
+#ifdef __TEENSY_LC__ 
+  0,  1, // pin 3
+  0,  2, // pin 4
+#else   
+  0, 12, // pin 3
+  0, 13, // pin 4
+#endif  
+  3,  7, // pin 5
+  3,  4, // pin 6
+  3,  2, // pin 7
+  3,  3, // pin 8
+  2,  3, // pin 9
+  2,  4, // pin 10
+  2,  6, // pin 11
+  2,  7, // pin 12
+  2,  5, // pin 13
+  3,  1, // pin 14
+  2,  0, // pin 15
+  1,  0, // pin 16
+  1,  1, // pin 17
+  1,  3, // pin 18
+  1,  2, // pin 19
+  3,  5, // pin 20
+  3,  6, // pin 21
+  2,  1, // pin 22
+  2,  2, // pin 23
+#if defined( __TEENSY_LC__ )
+  4, 20, // pin 24
+  4, 21, // pin 25
+  4, 30, // pin 26
+#elif defined( __TEENSY_35__ ) || defined( __TEENSY_36__ )
+  4, 26, // pin 24
+  0,  5, // pin 25
+  0, 14, // pin 26
+  0, 15, // pin 27
+  0, 16, // pin 28
+  1, 18, // pin 29
+  1, 19, // pin 30
+  1, 10, // pin 31
+  1, 11, // pin 32
+  4, 24, // pin 33
+  4, 25, // pin 34
+  2,  8, // pin 35
+  2,  9, // pin 36
+  2, 10, // pin 37
+  2, 11, // pin 38
+  0, 17, // pin 39
+  0, 28, // pin 40
+  0, 29, // pin 41
+  0, 26, // pin 42
+  1, 20, // pin 43
+  1, 22, // pin 44
+  1, 23, // pin 45
+  1, 21, // pin 46
+  3,  8, // pin 47
+  3,  9, // pin 48
+  1,  4, // pin 49
+  1,  5, // pin 50
+  3, 14, // pin 51
+  3, 13, // pin 52
+  3, 12, // pin 53
+  3, 15, // pin 54
+  3, 11, // pin 55
+  4, 10, // pin 56
+  4, 11, // pin 57
+#else
+  0,  5, // pin 24
+  1, 19, // pin 25
+  4,  1, // pin 26
+  2,  9, // pin 27
+  2,  8, // pin 28
+  2, 10, // pin 29
+  2, 11, // pin 30
+  4,  0, // pin 31
+  1, 18, // pin 32 
+  0,  4, // pin 33
+#endif
+};
+
+constexpr uint8_t pulse400_port( int8_t pin ) { return teensy_pins[pin].port; }
+constexpr uint8_t pulse400_bit( int8_t pin ) { return teensy_pins[pin].bit; }
+#if defined( PULSE400_QUEUE_FAST )
+constexpr uint8_t pulse400_width( uint8_t port ) { return port < 5 ? 32 : 0; } // Bits per port in reg_struct_t
+#elif defined( __TEENSY_LC__ )
+constexpr uint8_t pulse400_width( uint8_t port ) { return port == 1 || port == 4 ? 32 : ( port < 4 ? 8 : 0 ); } 
+#elif defined( __TEENSY_35__ ) || defined( __TEENSY_36__ )
+constexpr uint8_t pulse400_width( uint8_t port ) { return port == 2 || port == 3 ? 16 : ( port < 5 ? 32 : 0 ); } 
+#else
+constexpr uint8_t pulse400_width( uint8_t port ) { return port == 1 ? 32 : ( port == 0 || port == 2 ? 16 : ( port < 5 ? 8 : 0 ) ); } 
+#endif
+constexpr bool pulse400_valid( int8_t pin ) { 
+  return pin >= 0 && pin < (int8_t) ( sizeof( teensy_pins ) / sizeof( teensy_pins[0] ) ) && pulse400_bit( pin ) < pulse400_width( pulse400_port( pin ) ); 
+}
+
+#elif defined( __AVR_ATmega328P__ )
+
+constexpr uint8_t pulse400_port( int8_t pin ) { return pin < 8 ? 3 : ( pin < 14 ? 1 : 2 ); } // D0-D7, D8-D13, A0-A5
+constexpr uint8_t pulse400_bit( int8_t pin ) { return pin < 8 ? pin : ( pin < 14 ? pin - 8 : pin - 14 ); }
+constexpr bool pulse400_valid( int8_t pin ) { return pin >= 0 && pin < 20; }
+
+#else
+
+constexpr bool pulse400_valid( int8_t pin ) { return pin >= 0; }
+
+#endif
+
+constexpr bool pulse400_valid_pins( void ) { return true; }
+
+template <typename... T> constexpr bool pulse400_valid_pins( int8_t pin, T... pins ) { 
+  return pulse400_valid( pin ) && pulse400_valid_pins( pins... ); 
+}
+
+#if defined( __TEENSY_3X__ ) || defined( __AVR_ATmega328P__ )
+
+constexpr uint32_t pulse400_mask( uint8_t port ) { return 0; }
+
+template <typename... T> constexpr uint32_t pulse400_mask( uint8_t port, int8_t pin, T... pins ) { // Port bitmap for a set of pins
+  return ( pulse400_port( pin ) == port ? 1UL << pulse400_bit( pin ) : 0 ) | pulse400_mask( port, pins... ); 
+}
+
 #endif
 
 #undef PULSE400_OPTIMIZE_STANDARD
-#if !defined( __TEENSY_3X__ ) || !defined( PULSE400_OPTIMIZE_TEENSY_3X ) 
+#if ( !defined( __TEENSY_3X__ ) || !defined( PULSE400_OPTIMIZE_TEENSY_3X ) ) && !defined( PULSE400_SHIFT_595 )
   #if !defined( __AVR_ATmega328P__ ) || !defined( PULSE400_OPTIMIZE_ARDUINO_UNO )
     #define PULSE400_OPTIMIZE_STANDARD    
   #endif
 #endif
 
+#if !defined( PULSE400_OPTIMIZE_STANDARD ) 
+  #if defined( PULSE400_QUEUE_FAST )
+    #define PULSE400_QUEUE_MASKS // Queue entries carry the falling edge bitmaps of their group
+    #define PULSE400_QUEUE_GROUPS // Queue entries carry the number of entries merged into their group
+  #elif defined( __TEENSY_3X__ )
+    #define PULSE400_QUEUE_GROUPS
+  #endif
+#endif
+
+#if defined( PULSE400_SPLIT_ISR ) && ( !defined( __TEENSY_3X__ ) || !defined( PULSE400_QUEUE_MASKS ) || defined( PULSE400_SHIFT_595 ) )
+  #undef PULSE400_SPLIT_ISR
+#endif
+
+#if defined( __TEENSY_3X__ )
+  #define PULSE400_MINIMUM_INTERVAL 4 // Falling edges closer together than this are merged into one group
+  #define PULSE400_BLOCKING_MARGIN 2 // emitFrame() masks interrupts this many microseconds before each edge
+  #define PULSE400_COMMIT_LEAD 100 // Lazy mode: default lead time of the deferred queue rebuild
+#else
+  #define PULSE400_MINIMUM_INTERVAL 0
+  #define PULSE400_BLOCKING_MARGIN 8
+  #define PULSE400_COMMIT_LEAD 1000
+#endif
+
+#if defined( PULSE400_SHIFT_595 ) // Edge groups closer together than a chain write share one
+  #define PULSE400_SHIFT_BURST ( PULSE400_SHIFT_595 * 8000000L / PULSE400_SHIFT_CLOCK + PULSE400_SHIFT_595 ) // us: bits + byte overhead
+  #undef PULSE400_MINIMUM_INTERVAL
+  #define PULSE400_MINIMUM_INTERVAL ( PULSE400_SHIFT_BURST + 2 ) // + interrupt entry and latch pulse
+#endif
+
 class Esc400;
 class Servo400;
 class Multi400;
 class Pulse400;
+class Rc400;
+class Telemetry400;
 
 extern void PULSE400_ISR( void );
+extern void PULSE400_SOFT_ISR( void );
+
+typedef void ( *pulse400_hook_t )( void );
 
 struct channel_struct_t { 
-  uint16_t pin :5; 
-  uint16_t pw : 11;
+  int8_t pin; // PULSE400_UNUSED: free
+  uint16_t pw;
+  uint8_t div; // Output every div'th frame
 };
 
-#if defined( __TEENSY_3X__ ) && defined( PULSE400_OPTIMIZE_TEENSY_3X )    
+struct motion_struct_t { // Motion profile, Q8 fixed point microseconds and frames
+  int32_t pos;
+  int16_t speed; // Per frame
+  uint16_t slew; // Maximum speed
+  uint16_t accel; // Speed change per frame, 0: full speed right away
+  uint16_t target; // Channel units (like channel_struct_t.pw)
+};
+
+#if defined( PULSE400_SHIFT_595 )
+
+struct reg_struct_t { // Output state by register
+  volatile uint8_t out[PULSE400_SHIFT_595];
+};
+
+struct pulse400_map_t {
+  uint8_t port;
+  uint8_t mask;
+};
+
+inline void pulse400_reg_clear( reg_struct_t& reg ) {
+  for ( uint8_t r = 0; r < PULSE400_SHIFT_595; r++ ) reg.out[r] = 0;
+}
+
+inline void pulse400_reg_set( reg_struct_t& reg, int8_t pin ) {
+  reg.out[pulse400_port( pin )] |= 1 << pulse400_bit( pin );
+}
+
+#elif defined( __TEENSY_3X__ ) && defined( PULSE400_OPTIMIZE_TEENSY_3X )    
+
+#if defined( PULSE400_QUEUE_FAST )
 
 struct reg_struct_t {
-#ifdef __TEENSY_LC__ 
-  volatile uint16_t PA;
-  volatile uint8_t PB;
+  volatile uint32_t PA;
+  volatile uint32_t PB;
+  volatile uint32_t PC;
+  volatile uint32_t PD;
+  volatile uint32_t PE;
+};
+
+#else
+
+struct reg_struct_t { // Wide enough for the highest bit of each port the model has pins on
+#if defined( __TEENSY_LC__ )
+  volatile uint8_t PA;
+  volatile uint32_t PB;
   volatile uint8_t PC;
   volatile uint8_t PD;
+  volatile uint32_t PE;
+#elif defined( __TEENSY_35__ ) || defined( __TEENSY_36__ )
+  volatile uint32_t PA;
+  volatile uint32_t PB;
+  volatile uint16_t PC;
+  volatile uint16_t PD;
+  volatile uint32_t PE;
 #else  
   volatile uint16_t PA;
   volatile uint32_t PB;
-  volatile uint8_t PC;
+  volatile uint16_t PC;
   volatile uint8_t PD;
+  volatile uint8_t PE;
 #endif  
 };
 
+#endif
+
+struct pulse400_map_t { // Per channel port & bitmap (compact queue layout)
+  uint8_t port;
+  uint32_t mask;
+};
+
+inline void pulse400_reg_clear( reg_struct_t& reg ) {
+  reg.PA = reg.PB = reg.PC = reg.PD = reg.PE = 0;
+}
+
+inline void pulse400_reg_set( reg_struct_t& reg, int8_t pin ) {
+  switch ( pulse400_port( pin ) ) {
+    case 0: reg.PA |= 1UL << pulse400_bit( pin ); break;
+    case 1: reg.PB |= 1UL << pulse400_bit( pin ); break;
+    case 2: reg.PC |= 1UL << pulse400_bit( pin ); break;
+    case 3: reg.PD |= 1UL << pulse400_bit( pin ); break;
+    case 4: reg.PE |= 1UL << pulse400_bit( pin ); break;
+  }
+}
+
 #elif defined( __AVR_ATmega328P__ )
 
 struct reg_struct_t {
@@ -103,18 +476,78 @@ struct reg_struct_t {
   volatile uint8_t PD;
 };
 
+struct pulse400_map_t { // Per channel port & bitmap (compact queue layout)
+  uint8_t port;
+  uint8_t mask;
+};
+
+inline void pulse400_reg_clear( reg_struct_t& reg ) {
+  reg.PB = reg.PC = reg.PD = 0;
+}
+
+inline void pulse400_reg_set( reg_struct_t& reg, int8_t pin ) {
+  switch ( pulse400_port( pin ) ) {
+    case 1: reg.PB |= 1 << pulse400_bit( pin ); break;
+    case 2: reg.PC |= 1 << pulse400_bit( pin ); break;
+    case 3: reg.PD |= 1 << pulse400_bit( pin ); break;
+  }
+}
+
+#endif
+
+#if defined( PULSE400_QUEUE_FAST )
+
+struct queue_struct_t { // Naturally aligned, no bitfields
+  volatile uint8_t id; 
+#ifdef PULSE400_QUEUE_GROUPS
+  volatile uint8_t cnt;
+#endif
+  volatile uint16_t pw;
+#ifdef PULSE400_QUEUE_MASKS
+  reg_struct_t pins_low;
 #endif
+#ifdef PULSE400_AVR_NAKED
+  volatile uint16_t step; // Group head: timer ticks to the next group, 0 if the C++ ISR must handle this group
+#endif
+};
+
+#ifdef PULSE400_AVR_NAKED
+static_assert( sizeof( queue_struct_t ) == 9 && offsetof( queue_struct_t, step ) == 7, "Pulse400: the assembly ISR hardcodes the queue entry layout" );
+#endif
+
+#else
 
 struct queue_struct_t { 
   volatile uint16_t id : 5; 
   volatile uint16_t pw : 11;
-#if defined( __TEENSY_3X__ ) && defined( PULSE400_OPTIMIZE_TEENSY_3X )    
+#ifdef PULSE400_QUEUE_GROUPS
   volatile uint8_t cnt;
-  reg_struct_t pins_low;
 #endif
 };
 
-typedef queue_struct_t queue_t[PULSE400_MAX_CHANNELS + 1];
+#endif
+
+static_assert( PULSE400_MAX_ENTRIES < PULSE400_END_FLAG, "Pulse400: too many channels + events for the queue id field" );
+
+typedef queue_struct_t queue_t[PULSE400_MAX_ENTRIES + 1];
+
+struct event_struct_t { // Timed event, sorted into the queues with id PULSE400_MAX_CHANNELS + event number
+  int8_t pin; // -1: callback only
+  uint8_t edge;
+  uint16_t pw; // Offset from the frame start - PULSE400_MIN_PULSE, like the channels
+  uint8_t div; // Every div'th frame, 0: free
+  uint8_t repeat; // Frames left for a one-shot event, 0: until cancelled
+  pulse400_hook_t f;
+#if !defined( PULSE400_OPTIMIZE_STANDARD )
+  pulse400_map_t map;
+#endif
+};
+
+#if defined( PULSE400_QUEUE_GROUPS )
+  #define PULSE400_GROUP_SIZE( _entry ) ( (_entry).cnt ) // Pins handled by one interrupt
+#else
+  #define PULSE400_GROUP_SIZE( _entry ) 1
+#endif
 
 // Single ESC frontend for Pulse400: use this to control each motor as a single object
 
@@ -151,14 +584,25 @@ class Multi400 {
   Multi400& end( void );
   Multi400& autosync( bool v = true );
   Multi400& sync();
+  Multi400& oneshot( bool v = true );
+  Multi400& failsafe( uint8_t frames );
+  Multi400& mixer( const int16_t matrix[][4], uint8_t motors, const uint16_t * curve = NULL );
+  Multi400& mix( int16_t throttle, int16_t roll, int16_t pitch, int16_t yaw );
   Multi400& frequency( uint16_t f );
   Multi400& enabled( bool v );
+  Multi400& ramp( uint16_t rate, uint16_t accel = 0 );
   
   private:
   Pulse400 * pulse400;
   bool pulse_sync, disabled;
   uint16_t min = 1000;
   uint16_t max = 2000;
+  const int16_t ( *mix_matrix )[4] = NULL; // Q14 coefficients per motor: throttle, roll, pitch, yaw
+  const uint16_t * mix_curve = NULL;
+  uint8_t mix_motors = 0;
+  int32_t mix_scale = MULTI400_Q14; // ( max - min ) / 1000 in Q14
+  uint16_t ramp_rate = 0; // speed() ramps: units per second, 0: off
+  uint16_t ramp_accel = 0;
   
 };
 
@@ -176,6 +620,8 @@ class Servo400 {
   int readMicroseconds();            // returns current pulse width in microseconds for this servo (was read_us() in first release)
   bool attached(); // return true if this servo is attached, otherwise false 
   void frequency( uint16_t f );
+  void move( int value, uint16_t speed, uint16_t accel = 0 ); // like write() but at speed degrees per second, accel in degrees/s²
+  bool moving(); // true while a move() is running
   
   private:
   Pulse400 * pulse400;
@@ -193,24 +639,80 @@ class Pulse400 {
   public:
   Pulse400();
   int8_t attach( int8_t pin, int8_t force_id = -1 ); // Attaches pin
+  uint8_t attachAll( const int8_t pins[], uint8_t n, int8_t ids[], int8_t first_id = -1 ); // Attaches n pins at once
   Pulse400& detach( int8_t id_channel ); // Detaches and optionally frees timer
   Pulse400& pulse( int8_t id_channel, uint16_t pulse_width, bool no_update = false );
   int16_t pulse( int8_t id_channel );
+  Pulse400& move( int8_t id_channel, uint16_t pulse_width, uint16_t slew, uint16_t accel = 0 );
+  bool moving( int8_t id_channel );
   Pulse400& update( void );
+  Pulse400& lazy( bool v = true, uint16_t lead = PULSE400_COMMIT_LEAD );
+  Pulse400& poll( void );
   Pulse400& frequency( uint16_t f );
+  uint16_t frequency( void );
+  Pulse400& divider( int8_t id_channel, uint16_t div );
+  Pulse400& failsafe( uint8_t frames, uint16_t pw = PULSE400_DEFAULT_PULSE );
+  bool calibrate( Rc400& rc, int8_t id_channel, uint8_t rc_channel = 0, uint16_t pw = 1500, uint8_t samples = 16 );
+  Pulse400& latency( uint8_t group_size, int8_t us );
+  int8_t latency( uint8_t group_size );
+  bool failsafe( void );
   Pulse400& minPulse( int16_t f = 360 );
   Pulse400& sync( void );
+  Pulse400& oneshot( bool v = true );
+  Pulse400& minGap( uint16_t us = PULSE400_MIN_GAP );
+  Pulse400& adaptive( bool v = true, uint16_t esc_gap = 0 );
+  Pulse400& blocking( bool v = true );
+  Pulse400& emitFrame( void );
+  int8_t event( int8_t pin, uint8_t edge, uint16_t offset, pulse400_hook_t f = NULL, uint16_t div = 1, uint8_t repeat = 0 );
+  Pulse400& event( int8_t id_event, uint16_t offset );
+  Pulse400& cancel( int8_t id_event );
+  Pulse400& onFrame( pulse400_hook_t f, bool deferred = false );
+  Pulse400& onDeadline( pulse400_hook_t f, uint16_t lead = 0, bool deferred = false );
+  uint16_t frames( void );
+  uint16_t rate( void );
+  bool verify( void );
+  Pulse400& portPlan( Print& out, const int8_t pins[], uint8_t n );
 
   static Pulse400 * instance;  
   void handleTimerInterrupt( void );
+  void hook_run( void );
+#if defined( PULSE400_SPLIT_ISR )
+  void split_prepare( void );
+#endif
     
   private:
   int channel_count( void );
-  int channel_find( int pin = -1 ); // pin = -1 returns first free channel, returns -1 if none found
+  bool verify_queue( queue_struct_t queue[], uint8_t position[] );
+  int channel_find( int pin = -1 ); // pin = -1 returns a free channel, returns -1 if none found
   void timer_start( void );
   void timer_stop( void );
-  void update_queue_entry( queue_struct_t src[], queue_struct_t dst[], int8_t id_channel, uint16_t pw );
+  void frame_start( void );
+  bool frame_guard( void );
+  int16_t frame_high( void );
+  bool frame_deadline( void );
+  void init_failsafe( void );
+  int16_t frame_hook( void );
+  int16_t frame_end( uint16_t pw );
+  queue_t * emit_start( void );
+  void emit_end( uint16_t pw );
+  bool frame_event( event_struct_t& ev );
+  void event_run( uint8_t id );
+  void hook_call( uint8_t hook );
+  void hook_vector( bool deferred );
+  void commit( bool feed );
+  void motion_step( void );
+  void update_queue( queue_struct_t queue[], uint8_t position[] );
+  void update_queue_entry( queue_struct_t queue[], uint8_t position[], int8_t id_channel, uint16_t pw );
+  void late_update( int8_t id_channel, uint16_t pw );
   void init_optimization( queue_struct_t queue[], int8_t queue_cnt );
+  void init_groups( queue_struct_t queue[], int8_t first, int8_t last );
+#if defined( PULSE400_AVR_NAKED )
+  void init_steps( queue_struct_t queue[] );
+#endif
+#if defined( PULSE400_SHIFT_595 )
+  void shift_begin( void );
+#endif
+  void init_phases( uint8_t q );
   void sort_on_pulse_width( queue_struct_t list[], uint8_t size );
   void quicksort_on_pulse_width( queue_struct_t list[], int first, int last );
 #ifdef PULSE400_USE_INTERVALTIMER
@@ -223,23 +725,194 @@ class Pulse400 {
     volatile uint8_t active : 1;
     volatile uint8_t change : 1;
   } qctl;
-  volatile uint8_t update_cnt = 0;
   volatile uint16_t cycle_deadline = PULSE400_MIN_PULSE;
   volatile uint16_t cycle_width = PULSE400_PERIOD_MAX - PULSE400_MIN_PULSE;
+  volatile uint16_t cycle_gap = PULSE400_MIN_GAP;
+  volatile uint8_t mode = PULSE400_MODE_FREE;
+  volatile bool oneshot_pending = false;
+  volatile uint16_t frame_cnt = 0;
+  volatile uint16_t cycle_esc_gap = 0;
+  volatile uint16_t frame_rate = 0;
+  volatile uint16_t rate_cnt = 0;
+  volatile uint32_t rate_start = 0;
+  pulse400_hook_t volatile hook_frame = NULL;
+  pulse400_hook_t volatile hook_deadline = NULL;
+  volatile uint16_t hook_lead = 0;
+  volatile uint16_t hook_rest = 0;
+  volatile uint8_t hook_next = PULSE400_JMP_DEADLINE;
+  volatile uint8_t hook_deferred = 0;
+  volatile uint8_t hook_pending = 0;
+  volatile bool hook_busy = false;
+  volatile bool lazy_mode = false;
+  volatile bool lazy_pending = false; // update() was called since the last commit()
+  volatile bool lazy_busy = false;
+  volatile bool motion_pending = false; // Motion profiles changed channels since the last commit()
+  volatile bool switch_held = false; // A commit() is rebuilding the queue a pending switch would have used
+  volatile bool switch_missed = false; // The point of no return passed while it was held
+  volatile bool commit_deferred = false; // Changes wait for that switch, the point of no return schedules the commit
+  Telemetry400 * volatile telemetry = NULL;
+  volatile uint8_t failsafe_frames = 0; // Watchdog: frames without update() before the failsafe queue takes over (0 = off)
+  volatile uint8_t stale_cnt = 0;
+  volatile bool failsafe_active = false;
+  uint16_t failsafe_pw = PULSE400_DEFAULT_PULSE - PULSE400_MIN_PULSE;
+  volatile uint32_t emit_last = 0; // Blocking mode: time of the last falling edge
 
   channel_struct_t channel[PULSE400_MAX_CHANNELS];
   queue_t queue[2] = { { { PULSE400_END_FLAG } }, { { PULSE400_END_FLAG } } };
+  uint8_t position[2][PULSE400_MAX_ENTRIES]; // Queue index of each channel/event
+  uint32_t dirty[2] = { PULSE400_DIRTY_ALL, PULSE400_DIRTY_ALL }; // Channels changed since the queue was last built
+  queue_t failsafe_queue = { { PULSE400_END_FLAG } }; // Prebuilt, all channels at failsafe_pw
+  event_struct_t events[PULSE400_MAX_EVENTS];
+#if defined( PULSE400_MOTION )
+  motion_struct_t motion[PULSE400_MAX_CHANNELS];
+  volatile uint32_t motion_active = 0; // Bit per channel with a running profile
+#endif
+  volatile bool event_expired = false; // A one-shot event ran out, the next update() drops it from the queues
   
-#if defined( __AVR_ATmega328P__ ) && defined( PULSE400_OPTIMIZE_ARDUINO_UNO )
-  volatile reg_struct_t pins_high;
-#elif defined( __TEENSY_3X__ ) && defined( PULSE400_OPTIMIZE_TEENSY_3X )
-  volatile reg_struct_t pins_high;
+  inline bool hook_armed( void ) { // Something runs at the deadline lead time: a deadline hook or the lazy commit
+    return hook_deadline || lazy_mode;
+  }
+
+  inline queue_t * frame_queue( void ) { // The queue the ISR is working on
+    return failsafe_active ? &failsafe_queue : &queue[qctl.active];
+  }
+
+  inline int8_t frame_armed( void ) { // Queue index of the next falling edge group
+#if defined( PULSE400_AVR_NAKED )
+    if ( GPIOR0 & PULSE400_NAKED_INDEX ) { // The assembly ISR has moved on without updating qctl.next
+       return (queue_struct_t *)(uintptr_t)( GPIOR1 | ( (uint16_t) GPIOR2 << 8 ) ) - *frame_queue();
+    }
+#endif
+    return qctl.next;
+  }
+
+  int8_t latency_comp[PULSE400_MAX_CHANNELS + 1] = { 0 }; // Measured edge delay by group size, [0] = reference (deadline)
+
+  inline int16_t latency_adjust( int16_t interval, uint8_t done, uint8_t next ) { // Pre-shift the next edge group
+#if defined( PULSE400_LATENCY_COMP )
+    if ( interval > 0 ) { // 0: edge is due right now
+      interval += latency_comp[done] - latency_comp[next]; // The previous group was shifted as well
+      if ( interval < 1 ) interval = 1;
+    }
+#endif
+    return interval;
+  }
+
+  inline void emit_wait( pulse400_ticks_t start, uint16_t us ) { // Blocking mode: returns at start + us with interrupts disabled
+    pulse400_ticks_t ticks = (pulse400_ticks_t) us * PULSE400_TICKS_PER_US;
+    pulse400_ticks_t early = us > PULSE400_BLOCKING_MARGIN ? ticks - PULSE400_BLOCKING_MARGIN * PULSE400_TICKS_PER_US : 0;
+    while ( (pulse400_ticks_t)( PULSE400_TICKS() - start ) < early ); // Interrupts are still served here
+    cli();
+    while ( (pulse400_ticks_t)( PULSE400_TICKS() - start ) < ticks );
+  }
+  
+#if !defined( PULSE400_OPTIMIZE_STANDARD )
+  reg_struct_t pins_high[2][PULSE400_MAX_DIVIDER]; // Pins that go high, by queue and frame phase: switched with the queue
+#if defined( __TEENSY_3X__ ) && !defined( PULSE400_SHIFT_595 )
+  volatile uint8_t ports_used[2] = { 0, 0 }; // Bit per port with channels in the queue, the rising edges skip the others
+#endif
+#if defined( PULSE400_SPLIT_ISR )
+  struct { // Falling edge group(s) prepared by the bottom half for the next timer interrupt
+    reg_struct_t low;
+    uint16_t interval; // From these edges to the next group
+    uint16_t frame; // frame_cnt and queue index the preparation is valid for
+    uint8_t index;
+    uint8_t next; // Queue index after the group(s)
+  } split;
+  volatile bool split_ready = false;
+#endif
+#if defined( PULSE400_QUEUE_COMPACT )
+  pulse400_map_t pin_map[PULSE400_MAX_CHANNELS];
+#endif
+#if defined( PULSE400_SHIFT_595 )
+  reg_struct_t shift_state; // Chain outputs as last written
+#endif
+#endif
+
+};
+
+// Compile-time configured bank frontend for Pulse400: pins are template arguments, e.g. Bank400<4, 5, 6, 7> motors( pulse400 );
+// Channel count and port bitmaps are constants, pins are validated at compile time and banks of different sizes can
+// coexist on the same generator because channels are allocated instead of forced. A thin wrapper: the queue updates
+// and the ISR are the same runtime code every other frontend uses
+
+template <int8_t... pins> class Bank400 {
+
+  public:
+  static constexpr uint8_t channels = sizeof...( pins );
+  static_assert( channels > 0 && channels <= PULSE400_MAX_CHANNELS, "Bank400: invalid number of pins" );
+  static_assert( pulse400_valid_pins( pins... ), "Bank400: pin not supported by the Pulse400 output backend" );
+
+  Bank400( Pulse400& pulse400 ) {
+    this->pulse400 = &pulse400;
+    for ( uint8_t no = 0; no < channels; no++ ) id[no] = PULSE400_UNUSED; // speed()/set() before begin() do nothing
+  }
+
+  Bank400& begin( void ) { // attachAll() sets the pins up with one write per port on the UNO
+    static const int8_t list[] = { pins... };
+    pulse400->attachAll( list, channels, id );
+    return *this;
+  }
+
+  template <typename... V> Bank400& set( V... v ) { // One value for every pin
+    static_assert( sizeof...( v ) == channels, "Bank400: set() needs exactly one value per pin" );
+    uint8_t no = 0;
+    int dummy[] = { ( speed( no++, v, true ), 0 )... };
+    (void) dummy;
+    pulse400->update();
+    return *this;
+  }
+
+  Bank400& speed( uint8_t no, int16_t v, bool no_update = false ) {
+    if ( v > -1 && no < channels ) {
+      pulse400->pulse( id[no], map( constrain( v, 0, 1000 ), 0, 1000, min, max ), no_update );
+    }
+    return *this;
+  }
+
+  int16_t speed( uint8_t no ) {
+    int v = no < channels ? pulse400->pulse( id[no] ) : -1;
+    return v == -1 ? -1 : map( v, min, max, 0, 1000 );
+  }
+
+  Bank400& off( void ) {
+    for ( uint8_t no = 0; no < channels; no++ ) speed( no, 0, true );
+    pulse400->update();
+    return *this;
+  }
+
+  Bank400& outputRange( uint16_t min, uint16_t max ) {
+    this->min = min;
+    this->max = max;
+    return off();
+  }
+
+  Bank400& sync( void ) {
+    pulse400->sync();
+    return *this;
+  }
+
+  Bank400& end( void ) {
+    for ( uint8_t no = 0; no < channels; no++ ) pulse400->detach( id[no] );
+    return *this;
+  }
+
+#if defined( __TEENSY_3X__ ) || defined( __AVR_ATmega328P__ )
+  static constexpr uint32_t portMask( uint8_t port ) { // Bitmap of the bank's pins on a port (A=0, B=1, C=2, D=3, E=4)
+    return pulse400_mask( port, pins... );
+  }
 #endif
 
+  private:
+  Pulse400 * pulse400;
+  int8_t id[channels];
+  uint16_t min = 1000;
+  uint16_t max = 2000;
+
 };
 
 typedef struct {
-    uint8_t pin;
+    int8_t pin;
     uint16_t value;
     uint32_t last_high;
 } rc400_channel_struct;
@@ -256,6 +929,12 @@ class Rc400 {
  public:
   void pwm( int8_t p0, int8_t p1 = -1, int8_t p2 = -1, int8_t p3 = -1, int8_t p4 = -1, int8_t p5 = -1 );
   void ppm( int8_t p0 );
+  void sbus( HardwareSerial& port );
+  void ibus( HardwareSerial& port );
+  void sbus( void );
+  void ibus( void );
+  bool parse( uint8_t b );
+  void poll();
   int read( int ch );
   bool connected();
   void end();
@@ -267,6 +946,9 @@ class Rc400 {
 
  private:
   void set_channel( int ch, int pin );
+  void serial_start( HardwareSerial * port, uint8_t mode, uint8_t channels );
+  bool sbus_frame( void );
+  bool ibus_frame( void );
   rc400_channel_struct volatile channel[RC400_NO_OF_CHANNELS];
 #ifndef __TEENSY_3X__    
   rc400_int_struct volatile int_state[3];
@@ -274,5 +956,48 @@ class Rc400 {
   uint8_t volatile ppm_pulse_counter;
   uint32_t volatile ppm_last_pulse;
   uint32_t volatile last_interrupt;
+  uint8_t frame_channels = 0; // Channels carried by a single input (PPM, SBUS, IBUS), 0: PWM
+  HardwareSerial * serial = NULL;
+  uint8_t serial_mode = RC400_SERIAL_NONE;
+  uint8_t rx_buf[RC400_IBUS_FRAME]; // Frame being received, big enough for both protocols
+  uint8_t rx_pos = 0;
+    
+};
+
+// Binary telemetry record, little endian, see extras/telemetry400.py for a decoder
+
+struct __attribute__( ( packed ) ) telemetry400_record_t {
+  uint8_t sync; // TELEMETRY400_SYNC
+  uint8_t size; // Record size in bytes
+  uint8_t outputs; // Number of pw[] entries
+  uint8_t inputs; // Number of rc[] entries
+  uint16_t frame; // Frame counter (wraps around)
+  uint32_t time; // micros() at the end of the frame
+  uint16_t rate; // Frames per second
+  uint16_t dropped; // Records lost so far because the buffer was full
+  uint16_t pw[PULSE400_MAX_CHANNELS]; // Output pulse widths by channel id, 0 = not attached
+  int16_t rc[RC400_NO_OF_CHANNELS]; // RC input values, -1 = not attached
+  uint8_t checksum; // Sum of all previous bytes (modulo 256)
+};
+
+class Telemetry400 {
+ public:
+  Telemetry400& begin( Pulse400& pulse400, Rc400 * rc = NULL, uint8_t divider = 1 );
+  Telemetry400& drain( Print& out );
+  Telemetry400& end( void );
+  uint16_t dropped( void );
+  
+  void capture( void );
+
+ private:
+  Pulse400 * pulse400;
+  Rc400 * rc;
+  telemetry400_record_t buffer[TELEMETRY400_RECORDS];
+  volatile uint8_t head = 0;
+  volatile uint8_t tail = 0;
+  volatile uint16_t lost = 0;
+  uint8_t offset = 0;
+  uint8_t divider = 1;
+  uint8_t skip = 0;
     
 };
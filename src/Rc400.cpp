@@ -9,6 +9,11 @@ void Rc400::pwm( int8_t p0, int8_t p1, int8_t p2, int8_t p3, int8_t p4, int8_t p
   channel[3].pin = p3;
   channel[4].pin = p4;
   channel[5].pin = p5;
+  for ( int ch = 6; ch < RC400_NO_OF_CHANNELS; ch++ ) {
+    channel[ch].pin = -1;
+  }
+  frame_channels = 0;
+  serial = NULL;
   instance = this;
   last_interrupt = micros() - RC400_IDLE_DISCONNECT;
   for ( int ch = 0; ch < RC400_NO_OF_CHANNELS; ch++ ) {
@@ -35,6 +40,8 @@ void Rc400::ppm( int8_t p0 ) { // Pulse Position Modulation
     channel[ch].pin = -1;
   }
   channel[0].pin = p0;
+  frame_channels = RC400_NO_OF_CHANNELS;
+  serial = NULL;
   instance = this;
   last_interrupt = micros() - RC400_IDLE_DISCONNECT;
   pinMode( channel[0].pin, INPUT_PULLUP );
@@ -45,8 +52,118 @@ void Rc400::ppm( int8_t p0 ) { // Pulse Position Modulation
 #endif
 }
 
+// SBUS (Futaba, FrSky): 100000 baud 8E2 with an inverted signal. Teensy inverts in the UART, the UNO needs an 
+// external inverter. No per-channel interrupts: call poll() from loop() to decode the received bytes
+
+void Rc400::sbus( HardwareSerial& port ) {
+#if defined( SERIAL_8E2_RXINV )
+  port.begin( 100000, SERIAL_8E2_RXINV );
+#else
+  port.begin( 100000, SERIAL_8E2 );
+#endif
+  serial_start( &port, RC400_SERIAL_SBUS, 16 );
+}
+
+// IBUS (FlySky): 115200 baud 8N1, not inverted
+
+void Rc400::ibus( HardwareSerial& port ) {
+  port.begin( 115200 );
+  serial_start( &port, RC400_SERIAL_IBUS, 14 );
+}
+
+// Decoder only: the bytes come from another source through parse(), poll() does nothing
+
+void Rc400::sbus( void ) {
+  serial_start( NULL, RC400_SERIAL_SBUS, 16 );
+}
+
+void Rc400::ibus( void ) {
+  serial_start( NULL, RC400_SERIAL_IBUS, 14 );
+}
+
+void Rc400::serial_start( HardwareSerial * port, uint8_t mode, uint8_t channels ) {
+  end();
+  serial = port;
+  serial_mode = mode;
+  frame_channels = channels < RC400_NO_OF_CHANNELS ? channels : RC400_NO_OF_CHANNELS;
+  rx_pos = 0;
+  instance = this;
+  last_interrupt = micros() - RC400_IDLE_DISCONNECT;
+}
+
+// Decodes the bytes the UART has received since the last call
+
+void Rc400::poll() {
+  if ( serial ) {
+    while ( serial->available() > 0 ) {
+      parse( serial->read() );
+    }
+  }
+}
+
+// Feeds a single SBUS/IBUS byte to the frame decoder, returns true when it completed a valid frame
+// Frames are found by their header and checked by footer (SBUS) or checksum (IBUS), a bad frame resyncs
+// on the next header byte in the buffer
+
+bool Rc400::parse( uint8_t b ) {
+  uint8_t header = serial_mode == RC400_SERIAL_SBUS ? 0x0F : 0x20;
+  uint8_t size = serial_mode == RC400_SERIAL_SBUS ? RC400_SBUS_FRAME : RC400_IBUS_FRAME;
+  if ( serial_mode == RC400_SERIAL_NONE || ( rx_pos == 0 && b != header ) ) return false;
+  rx_buf[rx_pos++] = b;
+  if ( rx_pos < size ) return false;
+  rx_pos = 0;
+  if ( serial_mode == RC400_SERIAL_SBUS ? sbus_frame() : ibus_frame() ) return true;
+  for ( uint8_t i = 1; i < size; i++ ) {
+    if ( rx_buf[i] == header ) {
+      memmove( rx_buf, rx_buf + i, size - i );
+      rx_pos = size - i;
+      break;
+    }
+  }
+  return false;
+}
+
+// SBUS values 172..1811 are mapped to 988..2012 us. A frame with the failsafe flag is valid but not used, 
+// so connected() goes false while the receiver has no link
+
+bool Rc400::sbus_frame( void ) {
+  if ( rx_buf[24] != 0x00 && ( rx_buf[24] & 0xCF ) != 0x04 ) return false; // SBUS2 telemetry frames end in 0x04 - 0x34
+  if ( rx_buf[23] & 0xF0 ) return false; // Only ch17, ch18, frame lost and failsafe are defined: not a frame boundary
+  if ( rx_buf[23] & 0x08 ) return true; 
+  uint32_t bits = 0;
+  uint8_t cnt = 0;
+  uint8_t ch = 0;
+  for ( uint8_t i = 1; i < 23 && ch < frame_channels; i++ ) { // 11 bit channels, LSB first
+    bits |= (uint32_t) rx_buf[i] << cnt;
+    cnt += 8;
+    while ( cnt >= 11 && ch < frame_channels ) {
+      channel[ch++].value = 880 + ( ( ( bits & 0x7FF ) * 5 + 4 ) >> 3 ); // Rounded: 172 = 988, 992 = 1500, 1811 = 2012
+      bits >>= 11;
+      cnt -= 11;
+    }
+  }
+  last_interrupt = micros();
+  return true;
+}
+
+// IBUS values are pulse widths in microseconds, the checksum is 0xFFFF minus the sum of the first 30 bytes
+
+bool Rc400::ibus_frame( void ) {
+  uint16_t sum = 0xFFFF;
+  for ( uint8_t i = 0; i < RC400_IBUS_FRAME - 2; i++ ) {
+    sum -= rx_buf[i];
+  }
+  if ( rx_buf[1] != 0x40 || sum != ( rx_buf[30] | (uint16_t) rx_buf[31] << 8 ) ) return false;
+  for ( uint8_t ch = 0; ch < frame_channels; ch++ ) {
+    channel[ch].value = ( rx_buf[2 + ch * 2] | (uint16_t) rx_buf[3 + ch * 2] << 8 ) & 0x0FFF;
+  }
+  last_interrupt = micros();
+  return true;
+}
+
 int Rc400::read( int ch ) {
-  return channel[ch].pin > -1 ? channel[ch].value : -1;
+  if ( ch < 0 || ch >= RC400_NO_OF_CHANNELS ) return -1;
+  return ch < frame_channels || channel[ch].pin > -1 ? channel[ch].value : -1;
 }
 
 bool Rc400::connected() {
@@ -62,7 +179,7 @@ bool Rc400::connected() {
 
 void Rc400::end() {
 #ifdef __TEENSY_3X__
-  if ( channel[0].pin > -1 ) detachInterrupt( digitalPinToInterrupt( channel[1].pin ) );  
+  if ( channel[0].pin > -1 ) detachInterrupt( digitalPinToInterrupt( channel[0].pin ) );  
   if ( channel[1].pin > -1 ) detachInterrupt( digitalPinToInterrupt( channel[1].pin ) );  
   if ( channel[2].pin > -1 ) detachInterrupt( digitalPinToInterrupt( channel[2].pin ) );  
   if ( channel[3].pin > -1 ) detachInterrupt( digitalPinToInterrupt( channel[3].pin ) );  
@@ -76,6 +193,9 @@ void Rc400::end() {
   for ( int ch = 0; ch < RC400_NO_OF_CHANNELS; ch++ ) {
     channel[ch].pin = -1;
   }
+  frame_channels = 0;
+  serial = NULL;
+  serial_mode = RC400_SERIAL_NONE;
 }
 
 #ifdef __TEENSY_3X__
@@ -56,7 +56,23 @@ int Servo400::read() {
   return map( readMicroseconds(), min, max, 0, 180 );
 }                        
 
+// Per servo: output only every n-th generator frame so the servo gets at most f Hz (others keep the full rate)
+
 void Servo400::frequency( uint16_t f ) {
-  pulse400->frequency( f );
+  if ( f ) {
+    pulse400->divider( id_channel, ( pulse400->frequency() + f - 1 ) / f );
+  }
 }
 
+// Like write(), but the generator moves the servo there at speed degrees per second (accel: degrees/s², 0 = no ramp)
+// Returns right away, write() ends a running move
+
+void Servo400::move( int value, uint16_t speed, uint16_t accel ) {
+  if ( value < 200 ) value = map( value, 0, 180, min, max );
+  uint32_t span = max > min ? max - min : min - max;
+  pulse400->move( id_channel, value, speed * span / 180, accel * span / 180 );
+}
+
+bool Servo400::moving() {
+  return id_channel != -1 && pulse400->moving( id_channel );
+}
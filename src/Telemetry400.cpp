@@ -0,0 +1,86 @@
+#include <Pulse400.h>
+
+// Snapshots every divider'th frame into a ring buffer from the generator ISR, drain() writes them out without blocking
+
+Telemetry400& Telemetry400::begin( Pulse400& pulse400, Rc400 * rc /* = NULL */, uint8_t divider /* = 1 */ ) {
+  this->pulse400 = &pulse400;
+  this->rc = rc;
+  this->divider = divider ? divider : 1;
+  head = tail = offset = skip = 0;
+  lost = 0;
+  pulse400.telemetry = this;
+  return *this;
+}
+
+// Called from the generator ISR at the end of every frame
+
+void Telemetry400::capture( void ) {
+  if ( ++skip < divider ) return;
+  skip = 0;
+  uint8_t next = ( head + 1 ) % TELEMETRY400_RECORDS;
+  if ( next == tail ) { // Buffer full: drop the record
+    lost++;
+    return;
+  }
+  telemetry400_record_t& r = buffer[head];
+  r.sync = TELEMETRY400_SYNC;
+  r.size = sizeof( telemetry400_record_t );
+  r.outputs = PULSE400_MAX_CHANNELS;
+  r.inputs = RC400_NO_OF_CHANNELS;
+  r.frame = pulse400->frame_cnt;
+  r.time = micros();
+  r.rate = pulse400->frame_rate;
+  r.dropped = lost;
+  for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
+    r.pw[ch] = 0;
+  }
+  queue_struct_t * q = *pulse400->frame_queue(); // The queue of the frame that just ended
+  for ( int i = 0; q[i].id != PULSE400_END_FLAG; i++ ) {
+    if ( q[i].id < PULSE400_MAX_CHANNELS ) { // Skip timed events
+      r.pw[q[i].id] = q[i].pw + PULSE400_MIN_PULSE;
+    }
+  }
+  for ( int ch = 0; ch < RC400_NO_OF_CHANNELS; ch++ ) {
+    r.rc[ch] = rc ? rc->read( ch ) : -1;
+  }
+  head = next;
+}
+
+// Writes as much as the output accepts right now (availableForWrite()), call often
+
+Telemetry400& Telemetry400::drain( Print& out ) {
+  while ( tail != head ) {
+    telemetry400_record_t& r = buffer[tail];
+    if ( offset == 0 ) { // Checksum in the main loop, not in the ISR
+      uint8_t sum = 0;
+      for ( uint8_t i = 0; i < sizeof( r ) - 1; i++ ) {
+        sum += ( (uint8_t *) &r )[i];
+      }
+      r.checksum = sum;
+    }
+    int room = out.availableForWrite();
+    if ( room <= 0 ) break;
+    int n = sizeof( r ) - offset;
+    if ( n > room ) n = room;
+    out.write( (const uint8_t *) &r + offset, n );
+    offset += n;
+    if ( offset < sizeof( r ) ) break;
+    offset = 0;
+    tail = ( tail + 1 ) % TELEMETRY400_RECORDS;
+  }
+  return *this;
+}
+
+uint16_t Telemetry400::dropped( void ) {
+  cli();
+  uint16_t result = lost;
+  sei();
+  return result;
+}
+
+Telemetry400& Telemetry400::end( void ) {
+  cli();
+  pulse400->telemetry = NULL;
+  sei();
+  return *this;
+}
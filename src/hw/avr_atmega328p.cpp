@@ -7,17 +7,33 @@
 
 #if defined( __AVR_ATmega328P__ ) && defined( PULSE400_OPTIMIZE_ARDUINO_UNO ) 
 
-void Pulse400::init_optimization( queue_struct_t queue[], int8_t queue_cnt ) {
-  pins_high.PB = pins_high.PC = pins_high.PD = 0; 
-  for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
-    if ( channel[ch].pin != PULSE400_UNUSED ) {
-      if ( channel[ch].pin < 8 )
-        pins_high.PD |= 1UL << ( channel[ch].pin );
-      else if ( channel[ch].pin < 14 )      
-        pins_high.PB |= 1UL << ( channel[ch].pin - 8 );
-      else 
-        pins_high.PC |= 1UL << ( channel[ch].pin - 14 );        
+// Pull a single pin down (compact queue layout)
+
+static inline void pulse400_low( const pulse400_map_t& map ) {
+  switch ( map.port ) {
+    case 1: PORTB &= ~map.mask; break;
+    case 2: PORTC &= ~map.mask; break;
+    case 3: PORTD &= ~map.mask; break;
+  }
+}
+
+// Timed event: the edge first, then the callback (PINx writes toggle)
+
+void Pulse400::event_run( uint8_t id ) {
+  event_struct_t& ev = events[id - PULSE400_MAX_CHANNELS];
+  if ( frame_event( ev ) ) {
+    switch ( ev.edge ) {
+      case PULSE400_EDGE_HIGH: 
+        if ( ev.map.port == 1 ) PORTB |= ev.map.mask; else if ( ev.map.port == 2 ) PORTC |= ev.map.mask; else PORTD |= ev.map.mask; 
+        break;
+      case PULSE400_EDGE_LOW: 
+        pulse400_low( ev.map ); 
+        break;
+      case PULSE400_EDGE_TOGGLE: 
+        if ( ev.map.port == 1 ) PINB = ev.map.mask; else if ( ev.map.port == 2 ) PINC = ev.map.mask; else PIND = ev.map.mask; 
+        break;
     }
+    if ( ev.f ) ev.f();
   }
 }
 
@@ -26,36 +42,207 @@ void Pulse400::init_optimization( queue_struct_t queue[], int8_t queue_cnt ) {
 
 void Pulse400::handleTimerInterrupt( void ) {
   int16_t next_interval = 0;
-  queue_t * q = &queue[qctl.active];
+#if defined( PULSE400_AVR_NAKED )
+  if ( GPIOR0 & PULSE400_NAKED_INDEX ) { // Take over from the assembly ISR
+    qctl.next = frame_armed();
+    GPIOR0 = 0;
+  }
+#endif
+  if ( qctl.next == PULSE400_JMP_GUARD && !frame_guard() ) { // One-shot mode: idle until the next sync()
+    return;
+  }
+  if ( qctl.next == PULSE400_JMP_HOOK && ( next_interval = frame_hook() ) ) { // Deadline hook, then wait for the next state
+    SET_TIMER( next_interval, PULSE400_ISR );
+    return;
+  }
   if ( qctl.next == PULSE400_JMP_HIGH ) { // Set all pins HIGH
-    PORTB |= pins_high.PB; // Arduino UNO optimization: flip pins per bank
-    PORTC |= pins_high.PC;  
-    PORTD |= pins_high.PD;
-    qctl.next = PULSE400_JMP_DEADLINE;
-    next_interval = cycle_deadline;
-    SET_TIMER( cycle_deadline, PULSE400_ISR );
+    reg_struct_t& high = pins_high[qctl.active][frame_cnt & ( PULSE400_MAX_DIVIDER - 1 )]; // Frame phase for the channel dividers
+    PORTB |= high.PB; // Arduino UNO optimization: flip pins per bank
+    PORTC |= high.PC;  
+    PORTD |= high.PD;
+    SET_TIMER( frame_high(), PULSE400_ISR );
     return;
   } 
   if ( qctl.next == PULSE400_JMP_DEADLINE ) { 
-    if ( qctl.change ) {
-      qctl.change = false;
-      qctl.active = qctl.active ^ 1;
+    if ( frame_deadline() ) { // Pins the new queue doesn't have (detached) rose with the old one: pull them down now
+      reg_struct_t& rose = pins_high[qctl.active ^ 1][0];
+      reg_struct_t& kept = pins_high[qctl.active][0];
+      PORTB &= ~( rose.PB & ~kept.PB );
+      PORTC &= ~( rose.PC & ~kept.PC );
+      PORTD &= ~( rose.PD & ~kept.PD );
     }
-    qctl.next = 0;
-    next_interval = ( queue[qctl.active][qctl.next].pw + PULSE400_MIN_PULSE ) - cycle_deadline;
+    queue_t * q = frame_queue();
+    next_interval = latency_adjust( ( (*q)[qctl.next].pw + PULSE400_MIN_PULSE ) - cycle_deadline, 0, PULSE400_GROUP_SIZE( (*q)[qctl.next] ) );
   } 
   if ( next_interval == 0 ) {    
-    uint16_t previous_pw = (*q)[qctl.next].pw;
-    while ( !next_interval ) { // Process equal pulse widths in the same timer interrupt period
-      digitalWrite( channel[(*q)[qctl.next].id].pin, LOW );
-      next_interval = (*q)[++qctl.next].pw - previous_pw;
-    }
+    queue_t * q = frame_queue(); // Only after a possible queue switch
+    uint16_t previous_pw;
+    uint8_t done;
+    do { // Timed events may be due together with a falling edge group
+      previous_pw = (*q)[qctl.next].pw;
+      done = PULSE400_GROUP_SIZE( (*q)[qctl.next] );
+      if ( (*q)[qctl.next].id >= PULSE400_MAX_CHANNELS ) {
+        event_run( (*q)[qctl.next].id );
+        qctl.next++;
+      } else {
+#if defined( PULSE400_QUEUE_MASKS )
+        PORTB &= ~(*q)[qctl.next].pins_low.PB; // Pull the whole group down, one write per port
+        PORTC &= ~(*q)[qctl.next].pins_low.PC;
+        PORTD &= ~(*q)[qctl.next].pins_low.PD;
+        qctl.next += (*q)[qctl.next].cnt;
+#else
+        do { // Process equal pulse widths in the same timer interrupt period
+          pulse400_low( pin_map[(*q)[qctl.next].id] );
+          qctl.next++;
+        } while ( (*q)[qctl.next].id < PULSE400_MAX_CHANNELS && (*q)[qctl.next].pw == previous_pw ); // Stops at events and the sentinel
+#endif
+      }
+    } while ( (*q)[qctl.next].id != PULSE400_END_FLAG && (*q)[qctl.next].pw - previous_pw <= PULSE400_MINIMUM_INTERVAL );
     if ( (*q)[qctl.next].id == PULSE400_END_FLAG ) {
-      next_interval = cycle_width - previous_pw;
-      qctl.next = PULSE400_JMP_HIGH; 
+      next_interval = latency_adjust( frame_end( previous_pw ), done, 0 );
+    } else {
+      next_interval = latency_adjust( (*q)[qctl.next].pw - previous_pw, done, PULSE400_GROUP_SIZE( (*q)[qctl.next] ) );
     }
   } 
   SET_TIMER( next_interval, PULSE400_ISR );
+#if defined( PULSE400_AVR_NAKED )
+  if ( qctl.next < PULSE400_JMP_HIGH && (*frame_queue())[qctl.next].step ) { // Hand the following groups to the assembly ISR
+    uint16_t armed = (uintptr_t) &(*frame_queue())[qctl.next];
+    GPIOR1 = armed;
+    GPIOR2 = armed >> 8;
+    GPIOR0 = PULSE400_NAKED_RUN | PULSE400_NAKED_INDEX;
+  }
+#endif
+}
+
+#if defined( PULSE400_AVR_NAKED )
+
+// Compare A with PULSE400_AVR_NAKED: everything but the falling edge groups runs in the regular C++ ISR
+
+extern "C" void pulse400_slow_isr( void ) __attribute__(( signal, used ));
+
+void pulse400_slow_isr( void ) {
+  PULSE400_ISR();
+}
+
+// Falling edge group fast path, armed by the C++ ISR through GPIOR0-2 (see PULSE400_NAKED_RUN/INDEX)
+// Pulls the group at GPIOR1/2 down, schedules the next compare match from its precomputed step and moves
+// on to the next group, handing back to the C++ ISR when that group has no step
+// extras/avr/naked400.py runs these instructions against the C++ ISR's results and counts their cycles
+
+ISR( TIMER1_COMPA_vect, ISR_NAKED ) {
+  asm volatile (
+    "sbis %[gpior0], 0        \n\t" // Not armed: regular ISR
+    "jmp pulse400_slow_isr    \n\t"
+    "push r24                 \n\t"
+    "in r24, __SREG__         \n\t"
+    "push r24                 \n\t"
+    "push r25                 \n\t"
+    "push r26                 \n\t"
+    "push r27                 \n\t"
+    "push r30                 \n\t"
+    "push r31                 \n\t"
+    "in r30, %[gpior1]        \n\t" // Z: armed group head
+    "in r31, %[gpior2]        \n\t"
+    "ldd r25, Z+4             \n\t" // PORTB &= ~pins_low.PB
+    "com r25                  \n\t"
+    "in r24, %[portb]         \n\t"
+    "and r24, r25             \n\t"
+    "out %[portb], r24        \n\t"
+    "ldd r25, Z+5             \n\t" // PORTC &= ~pins_low.PC
+    "com r25                  \n\t"
+    "in r24, %[portc]         \n\t"
+    "and r24, r25             \n\t"
+    "out %[portc], r24        \n\t"
+    "ldd r25, Z+6             \n\t" // PORTD &= ~pins_low.PD
+    "com r25                  \n\t"
+    "in r24, %[portd]         \n\t"
+    "and r24, r25             \n\t"
+    "out %[portd], r24        \n\t"
+    "lds r24, %[ocr1al]       \n\t" // OCR1A + step
+    "lds r25, %[ocr1ah]       \n\t"
+    "ldd r26, Z+7             \n\t"
+    "ldd r27, Z+8             \n\t"
+    "add r24, r26             \n\t"
+    "adc r25, r27             \n\t"
+    "lds r26, %[tcnt1l]       \n\t" // Already late: TCNT1 + lead instead
+    "lds r27, %[tcnt1h]       \n\t"
+    "adiw r26, %[lead]        \n\t"
+    "cp r24, r26              \n\t"
+    "cpc r25, r27             \n\t"
+    "brpl 1f                  \n\t"
+    "movw r24, r26            \n\t"
+    "1:                       \n\t"
+    "sts %[ocr1ah], r25       \n\t" // High byte first
+    "sts %[ocr1al], r24       \n\t"
+    "ldd r24, Z+1             \n\t" // Z += cnt entries
+    "2:                       \n\t"
+    "adiw r30, %[size]        \n\t"
+    "dec r24                  \n\t"
+    "brne 2b                  \n\t"
+    "out %[gpior1], r30       \n\t"
+    "out %[gpior2], r31       \n\t"
+    "ldd r24, Z+7             \n\t" // No step: the next group is for the C++ ISR
+    "ldd r25, Z+8             \n\t"
+    "or r24, r25              \n\t"
+    "brne 3f                  \n\t"
+    "cbi %[gpior0], 0         \n\t"
+    "3:                       \n\t"
+    "pop r31                  \n\t"
+    "pop r30                  \n\t"
+    "pop r27                  \n\t"
+    "pop r26                  \n\t"
+    "pop r25                  \n\t"
+    "pop r24                  \n\t"
+    "out __SREG__, r24        \n\t"
+    "pop r24                  \n\t"
+    "reti                     \n\t"
+    :: [gpior0] "I" ( _SFR_IO_ADDR( GPIOR0 ) ), [gpior1] "I" ( _SFR_IO_ADDR( GPIOR1 ) ), [gpior2] "I" ( _SFR_IO_ADDR( GPIOR2 ) ),
+       [portb] "I" ( _SFR_IO_ADDR( PORTB ) ), [portc] "I" ( _SFR_IO_ADDR( PORTC ) ), [portd] "I" ( _SFR_IO_ADDR( PORTD ) ),
+       [ocr1al] "n" ( _SFR_MEM_ADDR( OCR1AL ) ), [ocr1ah] "n" ( _SFR_MEM_ADDR( OCR1AH ) ),
+       [tcnt1l] "n" ( _SFR_MEM_ADDR( TCNT1L ) ), [tcnt1h] "n" ( _SFR_MEM_ADDR( TCNT1H ) ),
+       [lead] "I" ( PULSE400_NAKED_LEAD ), [size] "I" ( sizeof( queue_struct_t ) )
+  );
+}
+
+#endif
+
+// Blocking mode: outputs a single frame polling TCNT1 instead of using the timer interrupt, returns after the 
+// last falling edge
+
+Pulse400& Pulse400::emitFrame( void ) {
+  if ( mode != PULSE400_MODE_BLOCKING ) return *this;
+  queue_t * q = emit_start();
+  reg_struct_t& high = pins_high[qctl.active][frame_cnt & ( PULSE400_MAX_DIVIDER - 1 )];
+  pulse400_ticks_t start = PULSE400_TICKS();
+  PORTB |= high.PB;
+  PORTC |= high.PC;  
+  PORTD |= high.PD;
+  sei();
+  uint16_t previous_pw = 0;
+  while ( (*q)[qctl.next].id != PULSE400_END_FLAG ) {
+    previous_pw = (*q)[qctl.next].pw;
+    emit_wait( start, previous_pw + PULSE400_MIN_PULSE ); // Interrupts are masked from here to the edge
+    if ( (*q)[qctl.next].id >= PULSE400_MAX_CHANNELS ) {
+      event_run( (*q)[qctl.next].id );
+      qctl.next++;
+    } else {
+#if defined( PULSE400_QUEUE_MASKS )
+      PORTB &= ~(*q)[qctl.next].pins_low.PB;
+      PORTC &= ~(*q)[qctl.next].pins_low.PC;
+      PORTD &= ~(*q)[qctl.next].pins_low.PD;
+      qctl.next += (*q)[qctl.next].cnt;
+#else
+      do { 
+        pulse400_low( pin_map[(*q)[qctl.next].id] );
+        qctl.next++;
+      } while ( (*q)[qctl.next].id < PULSE400_MAX_CHANNELS && (*q)[qctl.next].pw == previous_pw );
+#endif
+    }
+    sei();
+  }
+  emit_end( previous_pw );
+  return *this;
 }
 
 #endif
@@ -0,0 +1,164 @@
+#include <Pulse400.h>
+
+// Output backend for daisy chained 74HC595 shift registers: SER on MOSI, SRCLK on SCK, all RCLKs on
+// PULSE400_SHIFT_LATCH, QH' to the next register's SER. Works on any board with SPI, the queue carries the
+// per register bitmaps of every edge group (fast layout) and each group is a single chain write
+
+#if defined( PULSE400_SHIFT_595 )
+
+#include <SPI.h>
+
+#if !defined( FASTRUN )
+  #define FASTRUN
+#endif
+
+#if defined( __AVR__ )
+static volatile uint8_t * latch_port; // digitalWrite() is too slow to run for every edge group
+static uint8_t latch_mask;
+#endif
+
+static bool shift_started = false;
+
+// Write the outputs to the chain, the last register first, then latch them all in the same instant
+
+static inline void pulse400_shift( const reg_struct_t& reg ) {
+  for ( int8_t r = PULSE400_SHIFT_595 - 1; r >= 0; r-- ) {
+    SPI.transfer( reg.out[r] );
+  }
+#if defined( __TEENSY_3X__ )
+  digitalWriteFast( PULSE400_SHIFT_LATCH, HIGH );
+  digitalWriteFast( PULSE400_SHIFT_LATCH, LOW );
+#elif defined( __AVR__ )
+  *latch_port |= latch_mask;
+  *latch_port &= ~latch_mask;
+#else
+  digitalWrite( PULSE400_SHIFT_LATCH, HIGH );
+  digitalWrite( PULSE400_SHIFT_LATCH, LOW );
+#endif
+}
+
+// The timer restarts after the chain write: take the write off the interval to the next edge
+
+static inline int16_t pulse400_after_shift( int16_t interval ) {
+  return interval > (int16_t) PULSE400_SHIFT_BURST ? interval - PULSE400_SHIFT_BURST : 1;
+}
+
+// Claims the SPI bus (never released, the chain must have the bus to itself) and clears the chain
+
+void Pulse400::shift_begin( void ) {
+  if ( shift_started ) return;
+  pinMode( PULSE400_SHIFT_LATCH, OUTPUT );
+  digitalWrite( PULSE400_SHIFT_LATCH, LOW );
+#if defined( __AVR__ )
+  latch_port = portOutputRegister( digitalPinToPort( PULSE400_SHIFT_LATCH ) );
+  latch_mask = digitalPinToBitMask( PULSE400_SHIFT_LATCH );
+#endif
+  SPI.begin();
+  SPI.beginTransaction( SPISettings( PULSE400_SHIFT_CLOCK, MSBFIRST, SPI_MODE0 ) );
+  cli();
+  pulse400_reg_clear( shift_state );
+  pulse400_shift( shift_state );
+  sei();
+  shift_started = true;
+}
+
+// Timed event: the callback runs before the edge, which goes out with the rest of its group
+
+FASTRUN void Pulse400::event_run( uint8_t id ) {
+  event_struct_t& ev = events[id - PULSE400_MAX_CHANNELS];
+  if ( frame_event( ev ) ) {
+    switch ( ev.edge ) {
+      case PULSE400_EDGE_HIGH: shift_state.out[ev.map.port] |= ev.map.mask; break;
+      case PULSE400_EDGE_LOW: shift_state.out[ev.map.port] &= ~ev.map.mask; break;
+      case PULSE400_EDGE_TOGGLE: shift_state.out[ev.map.port] ^= ev.map.mask; break;
+    }
+    if ( ev.f ) ev.f();
+  }
+}
+
+// ISR for the shift register chain: rising edges and every falling edge group are one chain write each, so all
+// edges are late by the same PULSE400_SHIFT_BURST and the pulse widths are unaffected
+
+FASTRUN void Pulse400::handleTimerInterrupt( void ) {
+  int16_t next_interval = 0;
+  if ( qctl.next == PULSE400_JMP_GUARD && !frame_guard() ) { // One-shot mode: idle until the next sync()
+    return;
+  }
+  if ( qctl.next == PULSE400_JMP_HOOK && ( next_interval = frame_hook() ) ) { // Deadline hook, then wait for the next state
+    SET_TIMER( next_interval, PULSE400_ISR );
+    return;
+  }
+  if ( qctl.next == PULSE400_JMP_HIGH ) { // Set all pins HIGH
+    reg_struct_t& high = pins_high[qctl.active][frame_cnt & ( PULSE400_MAX_DIVIDER - 1 )]; // Frame phase for the channel dividers
+    for ( uint8_t r = 0; r < PULSE400_SHIFT_595; r++ ) shift_state.out[r] |= high.out[r];
+    pulse400_shift( shift_state );
+    SET_TIMER( pulse400_after_shift( frame_high() ), PULSE400_ISR );
+    return;
+  }
+  if ( qctl.next == PULSE400_JMP_DEADLINE ) { // Point of no return
+    if ( frame_deadline() ) { // Outputs the new queue doesn't have (detached) rose with the old one: down with the next write
+      reg_struct_t& rose = pins_high[qctl.active ^ 1][0];
+      reg_struct_t& kept = pins_high[qctl.active][0];
+      for ( uint8_t r = 0; r < PULSE400_SHIFT_595; r++ ) shift_state.out[r] &= ~( rose.out[r] & ~kept.out[r] );
+    }
+    queue_t * q = frame_queue();
+    next_interval = latency_adjust( ( (*q)[qctl.next].pw + PULSE400_MIN_PULSE ) - cycle_deadline, 0, PULSE400_GROUP_SIZE( (*q)[qctl.next] ) );
+  }
+  if ( next_interval == 0 ) { // Pull the pins DOWN, groups closer than a chain write were merged by init_groups()
+    queue_t * q = frame_queue();
+    uint16_t previous_pw;
+    uint8_t done;
+    do { // Timed events may be due together with a falling edge group
+      previous_pw = (*q)[qctl.next].pw;
+      done = (*q)[qctl.next].cnt;
+      if ( (*q)[qctl.next].id >= PULSE400_MAX_CHANNELS ) {
+        event_run( (*q)[qctl.next].id );
+        qctl.next++;
+      } else {
+        reg_struct_t& low = (*q)[qctl.next].pins_low;
+        for ( uint8_t r = 0; r < PULSE400_SHIFT_595; r++ ) shift_state.out[r] &= ~low.out[r];
+        qctl.next += (*q)[qctl.next].cnt;
+      }
+    } while ( (*q)[qctl.next].id != PULSE400_END_FLAG && (*q)[qctl.next].pw - previous_pw <= PULSE400_MINIMUM_INTERVAL );
+    pulse400_shift( shift_state ); // One write for everything that was due
+    if ( (*q)[qctl.next].id == PULSE400_END_FLAG ) {
+      next_interval = latency_adjust( frame_end( previous_pw ), done, 0 );
+    } else {
+      next_interval = latency_adjust( (*q)[qctl.next].pw - previous_pw, done, (*q)[qctl.next].cnt );
+    }
+    next_interval = pulse400_after_shift( next_interval );
+  }
+  SET_TIMER( next_interval, PULSE400_ISR );
+}
+
+// Blocking mode: outputs a single frame timed by the cycle counter instead of the timer, returns after the
+// last falling edge. The chain writes start at the edge times, so all edges are late by the same amount
+
+FASTRUN Pulse400& Pulse400::emitFrame( void ) {
+  if ( mode != PULSE400_MODE_BLOCKING ) return *this;
+  queue_t * q = emit_start();
+  reg_struct_t& high = pins_high[qctl.active][frame_cnt & ( PULSE400_MAX_DIVIDER - 1 )];
+  pulse400_ticks_t start = PULSE400_TICKS();
+  for ( uint8_t r = 0; r < PULSE400_SHIFT_595; r++ ) shift_state.out[r] |= high.out[r];
+  pulse400_shift( shift_state );
+  sei();
+  uint16_t previous_pw = 0;
+  while ( (*q)[qctl.next].id != PULSE400_END_FLAG ) {
+    previous_pw = (*q)[qctl.next].pw;
+    emit_wait( start, previous_pw + PULSE400_MIN_PULSE ); // Interrupts are masked from here to the edge
+    if ( (*q)[qctl.next].id >= PULSE400_MAX_CHANNELS ) {
+      event_run( (*q)[qctl.next].id );
+      qctl.next++;
+    } else {
+      reg_struct_t& low = (*q)[qctl.next].pins_low;
+      for ( uint8_t r = 0; r < PULSE400_SHIFT_595; r++ ) shift_state.out[r] &= ~low.out[r];
+      qctl.next += (*q)[qctl.next].cnt;
+    }
+    pulse400_shift( shift_state );
+    sei();
+  }
+  emit_end( previous_pw );
+  return *this;
+}
+
+#endif
@@ -1,94 +1,55 @@
 #include <Pulse400.h>
 
-#define PULSE400_MINIMUM_INTERVAL 4
-
 // Teensy 3.2 accepts a 800/803 interval ( breaks up at 802 )
 // Teensy LC  accepts a 800/802 interval ( breaks up at 801, but differently! )
 
 #if defined( __TEENSY_3X__ )  && defined( PULSE400_OPTIMIZE_TEENSY_3X )
-static struct { uint8_t port; uint8_t bit; } teensy_pins[] = { 
-// A=0, B=1, C=2, D=3, E=4 ports: LC port 3 & 4 differ
-  1, 16, // pin 0
-  1, 17, // pin 1
-  3,  0, // pin 2
-#ifdef __TEENSY_LC__ 
-  0,  1, // pin 3
-  0,  2, // pin 4
-#else   
-  0, 12, // pin 3
-  0, 13, // pin 4
-#endif  
-  3,  7, // pin 5
-  3,  4, // pin 6
-  3,  2, // pin 7
-  3,  3, // pin 8
-  2,  3, // pin 9
-  2,  4, // pin 10
-  2,  6, // pin 11
-  2,  7, // pin 12
-  2,  5, // pin 13
-  3,  1, // pin 14
-  2,  0, // pin 15
-  1,  0, // pin 16
-  1,  1, // pin 17
-  1,  3, // pin 18
-  1,  2, // pin 19
-  3,  5, // pin 20
-  3,  6, // pin 21
-  2,  1, // pin 22
-  2,  2, // pin 23
-  0,  5, // pin 24
-  1, 19, // pin 25 (Reg B is 8 bits on LC: not supported on Teensy LC)
-  4,  1, // pin 26 (Reg E is not supported)
-  2,  9, // pin 27 (Reg C is 8 bits: not supported)
-  2,  8, // pin 28 (Reg C is 8 bits: not supported)
-  2, 10, // pin 29 (Reg C is 8 bits: not supported)
-  2, 11, // pin 30 (Reg C is 8 bits: not supported)
-  4,  0, // pin 31 (Reg E: not supported)
-  1, 18, // pin 32 
-  0,  4, // pin 33
-};
-
-// Expand? Reg C 8 -> 16 bits, Reg B 8 -> 32 bits (LC), Reg E 8 bits: 5 bytes * (channels + 1)
-
-
-void Pulse400::init_optimization( queue_struct_t queue[], int8_t queue_cnt ) {
-  // Create a single set of bitmaps for turning pins on
-  pins_high.PA = pins_high.PB = pins_high.PC = pins_high.PD = 0;
-  for ( int ch = 0; ch < PULSE400_MAX_CHANNELS; ch++ ) {
-    if ( channel[ch].pin != PULSE400_UNUSED ) {
-      switch ( teensy_pins[channel[ch].pin].port ) {
-        case 0: pins_high.PA |= 1UL << teensy_pins[channel[ch].pin].bit; break;
-        case 1: pins_high.PB |= 1UL << teensy_pins[channel[ch].pin].bit; break;
-        case 2: pins_high.PC |= 1UL << teensy_pins[channel[ch].pin].bit; break;
-        case 3: pins_high.PD |= 1UL << teensy_pins[channel[ch].pin].bit; break;
-      }
-    }
-  }  
-  reg_struct_t bits;
-  int16_t skip_cnt = 1;
-  uint16_t last_pw = 0xFFfF;
-  queue_cnt--; // Counter points to PULSE400_END_FLAG entry, decrement for the first entry
-  while ( queue_cnt >= 0 ) { // Iterate for end to beginning
-    // Create pin bitmaps for every step of the queue for turning pins off again
-    // Merge bitmaps of entries with (almost) the same pulse width and increment the skip counter
-    if ( last_pw - queue[queue_cnt].pw <= PULSE400_MINIMUM_INTERVAL ) { 
-      skip_cnt++;
-    } else {
-      bits.PA = bits.PB = bits.PC = bits.PD = 0;
-      skip_cnt = 1;
-    }
-    queue[queue_cnt].cnt = skip_cnt;
-    switch ( teensy_pins[channel[queue[queue_cnt].id].pin].port ) {
-      case 0: bits.PA |= 1UL << teensy_pins[channel[queue[queue_cnt].id].pin].bit; break;
-      case 1: bits.PB |= 1UL << teensy_pins[channel[queue[queue_cnt].id].pin].bit; break;
-      case 2: bits.PC |= 1UL << teensy_pins[channel[queue[queue_cnt].id].pin].bit; break;
-      case 3: bits.PD |= 1UL << teensy_pins[channel[queue[queue_cnt].id].pin].bit; break;
+
+// The teensy_pins[] table lives in Pulse400.h so it can be used at compile time as well
+// init_optimization() and init_groups() are shared with the UNO backend (Pulse400.cpp)
+
+// Pull a single pin down (compact queue layout)
+
+static inline void pulse400_low( const pulse400_map_t& map ) {
+  switch ( map.port ) {
+    case 0: GPIOA_PCOR = map.mask; break;
+    case 1: GPIOB_PCOR = map.mask; break;
+    case 2: GPIOC_PCOR = map.mask; break;
+    case 3: GPIOD_PCOR = map.mask; break;
+    case 4: GPIOE_PCOR = map.mask; break;
+  }
+}
+
+// Timed event: the edge first, then the callback
+
+FASTRUN void Pulse400::event_run( uint8_t id ) {
+  event_struct_t& ev = events[id - PULSE400_MAX_CHANNELS];
+  if ( frame_event( ev ) ) {
+    switch ( ev.edge ) {
+      case PULSE400_EDGE_HIGH: 
+        switch ( ev.map.port ) {
+          case 0: GPIOA_PSOR = ev.map.mask; break;
+          case 1: GPIOB_PSOR = ev.map.mask; break;
+          case 2: GPIOC_PSOR = ev.map.mask; break;
+          case 3: GPIOD_PSOR = ev.map.mask; break;
+          case 4: GPIOE_PSOR = ev.map.mask; break;
+        }
+        break;
+      case PULSE400_EDGE_LOW: 
+        pulse400_low( ev.map ); 
+        break;
+      case PULSE400_EDGE_TOGGLE: 
+        switch ( ev.map.port ) {
+          case 0: GPIOA_PTOR = ev.map.mask; break;
+          case 1: GPIOB_PTOR = ev.map.mask; break;
+          case 2: GPIOC_PTOR = ev.map.mask; break;
+          case 3: GPIOD_PTOR = ev.map.mask; break;
+          case 4: GPIOE_PTOR = ev.map.mask; break;
+        }
+        break;
     }
-    queue[queue_cnt].pins_low = bits;
-    last_pw = queue[queue_cnt].pw;
-    queue_cnt--;
-  } 
+    if ( ev.f ) ev.f();
+  }
 }
 
 // ISR optimized for Teensy 3.x/LC
@@ -96,41 +57,181 @@ void Pulse400::init_optimization( queue_struct_t queue[], int8_t queue_cnt ) {
 // Teensy 3.1: ISR 0.5% duty cycle @8ch, set speed: 44 us
 // Teensy 3.1: ISR 0.42% duty cycle @8ch, set speed: 44 us (FASTRUN/PRIO 0, 0.44% error)
 // Teensy LC : ISR 1% duty cycle @8ch, set speed: 88 us
+// set speed figures above predate the incremental queue update (no full rebuild per pulse() anymore)
 
 FASTRUN void Pulse400::handleTimerInterrupt( void ) {
   int16_t next_interval = 0;
+#if defined( PULSE400_SPLIT_ISR )
+  if ( split_ready && split.index == qctl.next && split.frame == frame_cnt ) { // Top half: prepared edges, re-arm
+    GPIOA_PCOR = split.low.PA; // Every port: a pin of a port the new queue doesn't use may still be HIGH
+    GPIOB_PCOR = split.low.PB;
+    GPIOC_PCOR = split.low.PC;  
+    GPIOD_PCOR = split.low.PD;  
+    GPIOE_PCOR = split.low.PE;  
+    split_ready = false;
+    qctl.next = split.next;
+    SET_TIMER( split.interval, PULSE400_ISR );
+    NVIC_SET_PENDING( IRQ_SOFTWARE ); // Bottom half: prepare the next group
+    return;
+  }
+  split_ready = false; // Not prepared in time (or stale): the full path below
+#endif
+  if ( qctl.next == PULSE400_JMP_GUARD && !frame_guard() ) { // One-shot mode: idle until the next sync()
+    return;
+  }
+  if ( qctl.next == PULSE400_JMP_HOOK && ( next_interval = frame_hook() ) ) { // Deadline hook, then wait for the next state
+    SET_TIMER( next_interval, PULSE400_ISR );
+    return;
+  }
   if ( qctl.next == PULSE400_JMP_HIGH ) { // Set all pins HIGH
-    GPIOA_PSOR = pins_high.PA;  
-    GPIOB_PSOR = pins_high.PB;
-    GPIOC_PSOR = pins_high.PC;  
-    GPIOD_PSOR = pins_high.PD;   
-    qctl.next = PULSE400_JMP_DEADLINE;
-    SET_TIMER( cycle_deadline, PULSE400_ISR );
+    reg_struct_t& high = pins_high[qctl.active][frame_cnt & ( PULSE400_MAX_DIVIDER - 1 )]; // Frame phase for the channel dividers
+    uint8_t ports = ports_used[qctl.active]; // Only the ports with channels
+    if ( ports & 0x01 ) GPIOA_PSOR = high.PA;  
+    if ( ports & 0x02 ) GPIOB_PSOR = high.PB;
+    if ( ports & 0x04 ) GPIOC_PSOR = high.PC;  
+    if ( ports & 0x08 ) GPIOD_PSOR = high.PD;   
+    if ( ports & 0x10 ) GPIOE_PSOR = high.PE;   
+    SET_TIMER( frame_high(), PULSE400_ISR );
     return;
   }  
   if ( qctl.next == PULSE400_JMP_DEADLINE ) { // Point of no return
-    if ( qctl.change ) {
-      qctl.change = false;
-      qctl.active = qctl.active ^ 1;
+    if ( frame_deadline() ) { // Pins the new queue doesn't have (detached) rose with the old one: pull them down now
+      reg_struct_t& rose = pins_high[qctl.active ^ 1][0];
+      reg_struct_t& kept = pins_high[qctl.active][0];
+      GPIOA_PCOR = rose.PA & ~kept.PA;
+      GPIOB_PCOR = rose.PB & ~kept.PB;
+      GPIOC_PCOR = rose.PC & ~kept.PC;
+      GPIOD_PCOR = rose.PD & ~kept.PD;
+      GPIOE_PCOR = rose.PE & ~kept.PE;
     }
-    qctl.next = 0;
-    next_interval = ( queue[qctl.active][qctl.next].pw + PULSE400_MIN_PULSE ) - cycle_deadline;
+    queue_t * q = frame_queue();
+    next_interval = latency_adjust( ( (*q)[qctl.next].pw + PULSE400_MIN_PULSE ) - cycle_deadline, 0, PULSE400_GROUP_SIZE( (*q)[qctl.next] ) );
   }
   if ( next_interval == 0 ) { // Pull the pins DOWN, a bunch at a time if needed
-    queue_t * q = &queue[qctl.active];  
-    uint16_t previous_pw = (*q)[qctl.next].pw;
-    GPIOA_PCOR = (*q)[qctl.next].pins_low.PA;  
-    GPIOB_PCOR = (*q)[qctl.next].pins_low.PB;
-    GPIOC_PCOR = (*q)[qctl.next].pins_low.PC;  
-    GPIOD_PCOR = (*q)[qctl.next].pins_low.PD;  
-    qctl.next += (*q)[qctl.next].cnt;
-    next_interval = (*q)[qctl.next].pw - previous_pw;
+    queue_t * q = frame_queue();  
+    uint16_t previous_pw;
+    uint8_t done;
+    do { // Timed events may be due together with a falling edge group
+      previous_pw = (*q)[qctl.next].pw;
+      done = (*q)[qctl.next].cnt;
+      if ( (*q)[qctl.next].id >= PULSE400_MAX_CHANNELS ) {
+        event_run( (*q)[qctl.next].id );
+        qctl.next++;
+      } else {
+#if defined( PULSE400_QUEUE_MASKS )
+        reg_struct_t& low = (*q)[qctl.next].pins_low;
+        GPIOA_PCOR = low.PA; // Every port, see the top half
+        GPIOB_PCOR = low.PB;
+        GPIOC_PCOR = low.PC;  
+        GPIOD_PCOR = low.PD;  
+        GPIOE_PCOR = low.PE;  
+        qctl.next += (*q)[qctl.next].cnt;
+#else
+        uint8_t cnt = (*q)[qctl.next].cnt;
+        while ( cnt-- ) { // Pull the group down one pin at a time
+          pulse400_low( pin_map[(*q)[qctl.next].id] );
+          qctl.next++;
+        }
+#endif
+      }
+    } while ( (*q)[qctl.next].id != PULSE400_END_FLAG && (*q)[qctl.next].pw - previous_pw <= PULSE400_MINIMUM_INTERVAL );
     if ( (*q)[qctl.next].id == PULSE400_END_FLAG ) { 
-      next_interval = cycle_width - previous_pw;
-      qctl.next = PULSE400_JMP_HIGH; 
+      next_interval = latency_adjust( frame_end( previous_pw ), done, 0 );
+    } else {
+      next_interval = latency_adjust( (*q)[qctl.next].pw - previous_pw, done, (*q)[qctl.next].cnt );
     }
   } 
   SET_TIMER( next_interval, PULSE400_ISR );
+#if defined( PULSE400_SPLIT_ISR )
+  if ( qctl.next < PULSE400_END_FLAG ) NVIC_SET_PENDING( IRQ_SOFTWARE ); // Falling edges next: prepare them
+#endif
+}
+
+#if defined( PULSE400_SPLIT_ISR )
+
+// Bottom half, software interrupt: does the queue walk, grouping and interval maths of the timer interrupt's falling
+// edge path ahead of time. Events and the last group of the frame (frame_end()) are left to the full path
+
+void Pulse400::split_prepare( void ) {
+  cli();
+  uint8_t index = qctl.next;
+  uint16_t frame = frame_cnt;
+  sei();
+  if ( index >= PULSE400_END_FLAG ) return;
+  queue_t * q = frame_queue(); // Only switches at the deadline
+  reg_struct_t low;
+  pulse400_reg_clear( low );
+  uint8_t next = index;
+  uint16_t previous_pw;
+  uint8_t done;
+  do {
+    if ( (*q)[next].id >= PULSE400_MAX_CHANNELS ) return;
+    previous_pw = (*q)[next].pw;
+    done = (*q)[next].cnt;
+    low.PA |= (*q)[next].pins_low.PA;
+    low.PB |= (*q)[next].pins_low.PB;
+    low.PC |= (*q)[next].pins_low.PC;
+    low.PD |= (*q)[next].pins_low.PD;
+    low.PE |= (*q)[next].pins_low.PE;
+    next += (*q)[next].cnt;
+  } while ( (*q)[next].id != PULSE400_END_FLAG && (*q)[next].pw - previous_pw <= PULSE400_MINIMUM_INTERVAL );
+  if ( (*q)[next].id == PULSE400_END_FLAG ) return;
+  int16_t interval = latency_adjust( (*q)[next].pw - previous_pw, done, (*q)[next].cnt );
+  cli();
+  if ( qctl.next == index && frame_cnt == frame && !split_ready ) { // The timer didn't get there first
+    split.low = low;
+    split.interval = interval;
+    split.frame = frame;
+    split.index = index;
+    split.next = next;
+    split_ready = true;
+  }
+  sei();
+}
+
+#endif
+
+// Blocking mode: outputs a single frame timed by the cycle counter instead of the timer, returns after the 
+// last falling edge
+
+FASTRUN Pulse400& Pulse400::emitFrame( void ) {
+  if ( mode != PULSE400_MODE_BLOCKING ) return *this;
+  queue_t * q = emit_start();
+  reg_struct_t& high = pins_high[qctl.active][frame_cnt & ( PULSE400_MAX_DIVIDER - 1 )];
+  pulse400_ticks_t start = PULSE400_TICKS();
+  GPIOA_PSOR = high.PA;  
+  GPIOB_PSOR = high.PB;
+  GPIOC_PSOR = high.PC;  
+  GPIOD_PSOR = high.PD;   
+  GPIOE_PSOR = high.PE;   
+  sei();
+  uint16_t previous_pw = 0;
+  while ( (*q)[qctl.next].id != PULSE400_END_FLAG ) {
+    previous_pw = (*q)[qctl.next].pw;
+    emit_wait( start, previous_pw + PULSE400_MIN_PULSE ); // Interrupts are masked from here to the edge
+    if ( (*q)[qctl.next].id >= PULSE400_MAX_CHANNELS ) {
+      event_run( (*q)[qctl.next].id );
+      qctl.next++;
+    } else {
+#if defined( PULSE400_QUEUE_MASKS )
+      GPIOA_PCOR = (*q)[qctl.next].pins_low.PA;  
+      GPIOB_PCOR = (*q)[qctl.next].pins_low.PB;
+      GPIOC_PCOR = (*q)[qctl.next].pins_low.PC;  
+      GPIOD_PCOR = (*q)[qctl.next].pins_low.PD;  
+      GPIOE_PCOR = (*q)[qctl.next].pins_low.PE;  
+      qctl.next += (*q)[qctl.next].cnt;
+#else
+      uint8_t cnt = (*q)[qctl.next].cnt;
+      while ( cnt-- ) {
+        pulse400_low( pin_map[(*q)[qctl.next].id] );
+        qctl.next++;
+      }
+#endif
+    }
+    sei();
+  }
+  emit_end( previous_pw );
+  return *this;
 }
 
 #endif